@@ -1,16 +1,76 @@
+#include <algorithm> // for sort() (used by the benchmarks)
+#include <atomic> // for atomic (used by the shared-memory ring buffer)
 #include <cctype> // for toupper()
+#include <cstdarg> // for va_list (used by LogLine::format())
+#include <climits> // for INT_MIN and INT_MAX
+#include <condition_variable> // for condition_variable (used to run the simulated cores in lockstep)
+#include <cstdint> // for uint32_t
 #include <cstdlib> // for EXIT_SUCCESS and EXIT_FAILURE
 #include <cstring> // for strerror()
 #include <cerrno> // for errno
 #include <deque> // for deque (used for ready and blocked queues)
+#include <filesystem> // for remove_all() and create_directories() (used by the benchmarks and --generate)
 #include <fstream> // for ifstream (used for reading simulated programs)
 #include <iostream> // for cout, endl, and cin
+#include <memory> // for shared_ptr (used to share parsed programs between processes)
+#include <mutex> // for mutex (used to run the simulated cores in lockstep)
+#include <queue> // for priority_queue (used by the priority and shortest-remaining schedulers)
+#include <new> // for placement new (used to build the ring buffer inside its shared mapping) and bad_alloc
+#include <linux/futex.h> // for FUTEX_WAIT and FUTEX_WAKE (used by the shared-memory ring buffer)
+#include <linux/perf_event.h> // for perf_event_attr (used by the profiler's hardware counters)
 #include <sstream> // for stringstream (used for parsing simulated programs)
+#include <sys/mman.h> // for mmap() (used by the shared-memory ring buffer)
+#include <sys/resource.h> // for getrusage() (used by the benchmarks)
+#include <fcntl.h> // for open() (used to map program files)
+#include <sys/stat.h> // for stat() (used to notice when a cached program's file changes)
+#include <sys/syscall.h> // for syscall() and SYS_futex
 #include <sys/wait.h> // for wait()
+#include <thread> // for thread (the simulated cores run on OS threads)
+#include <time.h> // for clock_gettime() (used by the benchmarks)
 #include <unistd.h> // for pipe(), read(), write(), close(), fork(), and _exit()
-#include <vector> // for vector (used for PCB table) 
+#include <unordered_map> // for unordered_map (used by the program cache)
+#include <vector> // for vector (used for PCB table)
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // for __rdtsc() (used by the profiler)
+#endif
 using namespace std;
 
+// build with -DSIM_PROFILE=1 to compile in the profiler (see Profiler)
+#ifndef SIM_PROFILE
+#define SIM_PROFILE 0
+#endif
+
+// build with -DSIM_COUNT_ALLOCS=1 to count heap allocations for the benchmarks (see heapAllocations)
+#ifndef SIM_COUNT_ALLOCS
+#define SIM_COUNT_ALLOCS 0
+#endif
+
+/*
+In a build with -DSIM_COUNT_ALLOCS=1, every operator new in the program counts itself in heapAllocations, so the "churn" benchmark can measure an allocation rate
+    - the default build leaves the global operator new and delete alone --> heapAllocations stays 0, and the benchmarks print n/a for it
+    - the count is per thread, so threads allocating at the same time (ex: a --batch run) don't fight over it
+    - these are kept out of line, so the compiler still pairs each new with its delete rather than seeing malloc() and free()
+*/
+const bool COUNT_ALLOCS_BUILD = SIM_COUNT_ALLOCS != 0;
+thread_local unsigned long heapAllocations = 0;
+
+#if SIM_COUNT_ALLOCS
+__attribute__((noinline)) void *operator new(size_t size) {
+    heapAllocations++;
+    void *memory = malloc(size > 0 ? size : 1);
+    if (memory == NULL) throw bad_alloc();
+    return memory;
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+#endif
+
 /* 
 Instruction class defintion --> an instance will feature 2 things
     1. A character signifying it's operation
@@ -27,18 +87,261 @@ class Instruction {
 };
 
 /*
-Cpu class definition --> an instance will feature 3 things
-    1. A vector of Instructions --> this vector will contain ALL the instructions for the currently running process
-        - ex) if process 0's instructions were from the "init" file, then this vector would contain S 1000, A 19, etc...
+Here, we've defined an opcode for each operation an Instruction can carry
+    - these are what the compact Op below stores in place of the operation character
+*/
+enum Opcode {
+    OP_SET = 0,     // S
+    OP_ADD,         // A
+    OP_DECREMENT,   // D
+    OP_BLOCK,       // B
+    OP_END,         // E
+    OP_FORK,        // F
+    OP_REPLACE,     // R
+    OP_COUNT
+};
+
+/*
+Op class definition --> the compact, pre-decoded form of an Instruction (exactly 8 bytes)
+    1. opcode --> which operation to run (see the Opcode enum above)
+    2. arg
+        - for S, A, D and F this is the integer argument
+        - for B this is how many ticks the process stays blocked (0 --> until a U command unblocks it)
+        - for R this is the index of the filename in the program's string table (so no string is copied around with the instruction)
+*/
+class Op {
+    public:
+        uint8_t opcode;
+        uint8_t padding[3];
+        int32_t arg;
+};
+
+/*
+Superinstruction class definition --> what optimizeProgram() works out about each S, A or D in a program, so a run of them can be done in one step
+    1. length --> how many S/A/D operations there are from this one to the next B, E, F or R (or the end of the program), this one included
+    2. lastSet --> the index of the last S at or before this operation, in the same run (-1 if there is none)
+    3. sum --> the total of every A (plus) and D (minus) from the start of the run up to and including this operation
+- doing operations i..j of a run to a value v then gives:
+    - ops[s].arg + (sum[j] - sum[s]), where s = lastSet[j] is the last S in i..j (everything before it was overwritten)
+    - v + sum[j] - (sum[i] minus operation i's own change), if there is no S in i..j
+- so any number of quanta spent inside a run cost O(1) (see runSuperinstructions())
+*/
+class Superinstruction {
+    public:
+        uint32_t length;
+        int32_t lastSet;
+        int64_t sum;
+};
+
+/*
+InstructionPool class definition --> the allocator behind every Program's instructions (and the Program itself, see ProgramCache)
+    - blocks come in power-of-two size classes (64 bytes and up), and a freed block goes onto its class' free list rather than back to malloc
+        - so once each program a workload uses has been loaded (and let go of) once, loading it again takes nothing from the heap
+        - blocks over 1 MB aren't kept, so one huge program doesn't pin its memory forever
+    - programs are only loaded and freed by forks, replaces and restores (never per instruction), so one lock around the free lists is plenty
+*/
+class InstructionPool {
+    public:
+        unsigned long allocations; // blocks that had to come from the heap
+        unsigned long reuses;      // blocks that came off a free list
+
+        InstructionPool() : allocations(0), reuses(0) {
+            memset(freeLists, 0, sizeof(freeLists));
+        }
+
+        void *allocate(size_t bytes) {
+            int sizeClass = classOf(bytes);
+            if (sizeClass > LARGEST_CLASS) return ::operator new(bytes);
+            lock_guard<mutex> guard(lock);
+            FreeBlock *block = freeLists[sizeClass];
+            if (block != NULL) {
+                freeLists[sizeClass] = block->next;
+                reuses++;
+                return block;
+            }
+            allocations++;
+            return ::operator new(static_cast<size_t>(1) << sizeClass);
+        }
+
+        void deallocate(void *memory, size_t bytes) {
+            int sizeClass = classOf(bytes);
+            if (sizeClass > LARGEST_CLASS) {
+                ::operator delete(memory);
+                return;
+            }
+            lock_guard<mutex> guard(lock);
+            FreeBlock *block = static_cast<FreeBlock *>(memory);
+            block->next = freeLists[sizeClass];
+            freeLists[sizeClass] = block;
+        }
+
+    private:
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        static const int SMALLEST_CLASS = 6;  // 64 bytes
+        static const int LARGEST_CLASS = 20;  // 1 MB
+
+        mutex lock;
+        FreeBlock *freeLists[LARGEST_CLASS + 1];
+
+        // the size class that bytes round up to (log2 of its block size)
+        static int classOf(size_t bytes) {
+            int sizeClass = SMALLEST_CLASS;
+            while ((static_cast<size_t>(1) << sizeClass) < bytes) sizeClass++;
+            return sizeClass;
+        }
+};
+
+InstructionPool instructionPool;
+
+// an allocator for standard containers that takes its memory from instructionPool
+template <typename T> class PoolAllocator {
+    public:
+        typedef T value_type;
+
+        PoolAllocator() {}
+        template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+        T *allocate(size_t count) {
+            return static_cast<T *>(instructionPool.allocate(count * sizeof(T)));
+        }
+
+        void deallocate(T *memory, size_t count) {
+            instructionPool.deallocate(memory, count * sizeof(T));
+        }
+};
+
+template <typename T, typename U> bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U> bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) {
+    return false;
+}
+
+/*
+Program class definition --> a decoded program, ready for quantum() to run
+    1. ops --> one Op per instruction, in order
+        - when a compiled program file is loaded, ops stays empty and the Ops are used straight out of the mapped file instead (see code())
+    2. strings --> the side table holding the filename of every R instruction
+    3. source --> the file the program was read from (empty if it wasn't read from a file)
+    4. superinstructions --> one Superinstruction per Op, filled in by optimizeProgram() the first time runSuperinstructions() folds the program's arithmetic
+        - it stays empty (costing nothing) for a program that is never folded, ex: with --superinstructions=off, or with every instruction logged
+        - it is mutable because it only caches what ops already says --> a shared program never changes in any way a process can see
+- ops, strings and superinstructions live in instructionPool, so parsing a program again after an earlier copy was freed reuses that copy's memory
+*/
+class Program {
+    public:
+        vector<Op, PoolAllocator<Op> > ops;
+        vector<string, PoolAllocator<string> > strings;
+        string source;
+        mutable vector<Superinstruction, PoolAllocator<Superinstruction> > superinstructions;
+
+        Program() : mapping(NULL), mappingSize(0), mappedOps(NULL), mappedCount(0) {}
+
+        ~Program() {
+            if (mapping != NULL) munmap(mapping, mappingSize);
+        }
+
+        // the Ops to run, wherever they live
+        const Op *code() const {
+            return mappedOps != NULL ? mappedOps : ops.data();
+        }
+
+        size_t size() const {
+            return mappedOps != NULL ? mappedCount : ops.size();
+        }
+
+        // makes the program run count Ops that live inside a mapping of a compiled program file (the mapping is unmapped along with the program)
+        void adoptMapping(void *memory, size_t memorySize, const Op *mapped, size_t count) {
+            mapping = memory;
+            mappingSize = memorySize;
+            mappedOps = mapped;
+            mappedCount = count;
+        }
+
+        // decodes instruction and appends it to the program
+        // (only while the program is being built --> once a program is shared through a ProgramHandle it never changes)
+        void append(const Instruction &instruction) {
+            Op op;
+            memset(&op, 0, sizeof(op));
+            switch (instruction.operation) {
+                case 'S': op.opcode = OP_SET; op.arg = instruction.intArg; break;
+                case 'A': op.opcode = OP_ADD; op.arg = instruction.intArg; break;
+                case 'D': op.opcode = OP_DECREMENT; op.arg = instruction.intArg; break;
+                case 'B': op.opcode = OP_BLOCK; op.arg = instruction.intArg; break;
+                case 'E': op.opcode = OP_END; break;
+                case 'F': op.opcode = OP_FORK; op.arg = instruction.intArg; break;
+                case 'R':
+                    op.opcode = OP_REPLACE;
+                    op.arg = static_cast<int32_t>(strings.size());
+                    strings.push_back(instruction.stringArg);
+                    break;
+            }
+            ops.push_back(op);
+        }
+
+    private:
+        void *mapping;
+        size_t mappingSize;
+        const Op *mappedOps;
+        size_t mappedCount;
+
+        // a Program may own a mapping, so it can't be copied
+        Program(const Program &);
+        Program &operator=(const Program &);
+};
+
+/*
+ProgramHandle --> how a process holds on to its program
+    - programs are immutable once parsed, so every process running the same file shares one copy
+    - this makes a process image copy-on-write for free --> a forked child just takes another handle to its parent's program, and an R in either
+      process points that process alone at the new program
+    - the program is freed when the last handle to it goes away
+*/
+typedef shared_ptr<const Program> ProgramHandle;
+
+// the program of a process that has none (ex: one whose R named a file that couldn't be loaded) --> it just runs off its end
+const Program emptyProgram;
+
+class SchedulingPolicy;
+class CoreProfile;
+
+/*
+Cpu class definition --> one simulated core; an instance will feature these things
+    1. A Program --> this will contain ALL the (decoded) instructions for the currently running process
+        - ex) if process 0's instructions were from the "init" file, then this program would contain S 1000, A 19, etc...
+        - program holds on to it for as long as the core runs it, so it can't be freed under the core (ex: by a process on another core ending)
     2. A integer corresponding to the programCounter of a given process
     3. An integer that we'll manipulate as we run through various processes
         - this value is initialized to 1000, and will be incremented, decremented, etc... by various processes' instructions
+    4. sliceUsed --> how many quanta the running process has had since it was (re)scheduled, for time-slice preemption
+    5. runningProcessID / runQueue --> the process this core is running (-1 if none) and the core's own ready queue
+    6. quantumProcessID, pendingOp and output --> what happened on the core during the current quantum (see quantum())
+    7. busyQuanta / migrations --> statistics: quanta spent running a process, and processes dispatched here that last ran on another core
+    8. profile --> the core's opcode counters while profiling (see Profiler), NULL otherwise
+- each core gets its own cache line, since the core threads write to their cores at the same time
 */
-class Cpu {
+class alignas(64) Cpu {
     public:
-        vector<Instruction> *pProgram;
+        const Program *pProgram;
+        ProgramHandle program;
         int programCounter;
         int value;
+        unsigned int sliceUsed;
+        int runningProcessID;
+        SchedulingPolicy *runQueue;
+        int quantumProcessID;
+        const Op *pendingOp;
+        string output;
+        unsigned long busyQuanta;
+        unsigned long migrations;
+        CoreProfile *profile;
+
+        Cpu() : pProgram(&emptyProgram), programCounter(0), value(0), sliceUsed(0), runningProcessID(-1), runQueue(NULL),
+                quantumProcessID(-1), pendingOp(NULL), busyQuanta(0), migrations(0), profile(NULL) {}
 };
 
 /*
@@ -48,512 +351,6113 @@ Here, we've defined 4 states in which a created process can be in
     2. STATE_RUNNING --> the process is currently being run by the CPU
     3. STATE_BLOCKED --> the process has been blocked by a 'B' instruction
         - to unblock, we must enter 'U' as a process simulator
+        - or, for a "B <ticks>" instruction, wait for its timer to unblock it (see TimerWheel)
     4. STATE_FINISHED --> the process has finished it's entire execution
         - a process will only be in this state if it has run an 'E' operation
             - an 'E' operation is run when either the process has an 'E' operation in it's list of operations, OR if the file containing the list of operations ends
+- STATE_FREE isn't a state a process is ever in --> it marks a PCB slot that holds no process, waiting to be handed out again (see PcbTable::release())
 */
 enum State {
-    STATE_READY = 1,
+    STATE_FREE = 0,
+    STATE_READY,
     STATE_RUNNING,
     STATE_BLOCKED,
     STATE_FINISHED
 };
 
 /*
-PcbEntry class definition --> an instance will feature various things
-    1. processId --> this is the ID of the process itself...
-        - in our simulation, this simply corresponds to the process # in order of creation (with 0 indexing)
-            ex) our first ever process will have a processId of 0
-            ex) our first ever fork will create a child process, which is our second process in our entire simulation; thus, it'll have a processId of 1 (due to 0-indexing)
-    2. parentProcessId --> this is the ID of a process' parent if it has one
-        - this will only be set if the process was created via a fork... so every process besides process 0
-    3. program
-        - this is a vector containing ALL the instructions that the current process has and will run
-        - ex) Process 0's program vector will contain each instruction in the "init" file
-    4. programCounter
+PcbHot class definition --> the fields of a process that we touch on every context switch or state scan
+    1. programCounter
         - this is the programCounter of a specific process --> this allows a process to keep track of where it is in it's own list of instructions,making sure that when context-switching occurs, when we return to a process, it continues its instruction(s) from where we last left off
-    5. value
-    6. state
+    2. value
+    3. state
         - this corresponds to the state of a given process --> we defined the four possible states (ready, running, blocked, finished) with an enum
-    7. startTime
-        - this corresponds to the startTime of a given process (used to calculate turnaround time)
-    8. finishTime
-        - this corresponds to the finishTime of a given process (used to calculate turnaround time)
-- In short, a PcbEntry is just a process...
+- these three are packed together so that a scan over every process' state walks one dense array
 */
-class PcbEntry {
+class PcbHot {
     public:
-        int processId;
-        int parentProcessId;
-        vector<Instruction> program;
         unsigned int programCounter;
         int value;
         State state;
-        unsigned int startTime;
-        unsigned int finishTime;
 };
 
 /*
-Let's setup our simulation --> here's a few important variables
-    1. An array of PcbEntry
-        - this will allow us to reference all of our processes
-        - notice we fix the size to 10 --> for the purpose of this simulation, we'll have less than 10 processes anyway...
-    2. timestamp
-        - this is quite literally time --> at the start of our simulation, it'll be at time 0. this value will be incremented as we put in the 'Q' instruction, passing time quantum
-    3. cpu
-        - this will be our sole instance of the cpu in our simulation
-    4. currentRunningProcessID
-        - At all times, we'll have a reference to the ID of the current running process using this variable
-        - since we now have an array of PcbEntry, the ID of a process corresponds to it's index in the array...
-    5. readyState
-        - queue containing processes in a ready state
-    6. blockedState
-        - queue containing processes in a blocked state
-    7. numProcesses
-        - a variable to keep track of the number of processes at a given moment
-        - this allows us to create processes in our array of PcbEntry more easily because upon initialization
-*/
-PcbEntry pcbEntry[10];
-unsigned int timestamp = 0;
-Cpu cpu;
-int currentRunningProcessID = -1;
-deque<int> readyState;
-deque<int> blockedState;
-int numProcesses = 1;
-
-/*
-trim() is a function that trims leading and trailing whitespace of an instruction
-    - ex) "     S 1000     " becomes "S 1000"
+StateList class definition --> every process in one state, as a doubly-linked list threaded through the PCB table (see PcbTable below)
+    1. head / tail --> the first and last process in the list (-1 if it is empty)
+        - processes are kept in the order they entered the state --> so the head of the BLOCKED list is the process that has been blocked the longest
+    2. count --> the number of processes in the list
 */
-string trim(string &str) {
-    // trim leading whitespace
-    size_t start = str.find_first_not_of(" \t\n\r\f\v");
-    if (start != string::npos) str = str.substr(start);
+class StateList {
+    public:
+        int head;
+        int tail;
+        int count;
 
-    // trim trailing whitespace
-    size_t end = str.find_last_not_of(" \t\n\r\f\v");
-    if (end != string::npos) str = str.substr(0, end + 1);
+        StateList() : head(-1), tail(-1), count(0) {}
+};
 
-    return str;
-}
+/*
+PIDs --> the low PID_SLOT_BITS bits of a PID are its PCB slot, and the bits above them are how many times that slot has been reused
+    - so the table holds at most PID_SLOTS (~4 million) processes at a time, and a slot's PIDs repeat after PID_GENERATIONS reuses
+*/
+const int PID_SLOT_BITS = 22;
+const int PID_SLOTS = 1 << PID_SLOT_BITS;
+const unsigned int PID_GENERATIONS = 1u << (31 - PID_SLOT_BITS);
 
 /*
-This function creates a process' program for us based on a file
-    - It takes in two parameters
-        1. A file
-            - this file contains a series of instructions
-            - see "init" for an example
-        2. A reference to the newly-created process' program vector
-            - recall: this vector contains all of the process' instructions
-            - thus, as we read from the file we specify in this function, we'll keep adding instructions line by line to the vector
+PcbTable class definition --> our table of processes, stored as a struct-of-arrays
+    - index i of every array below describes the process in PCB slot i
+    1. hot --> programCounter, value and state (see PcbHot above)
+    2. processId --> this is the ID of the process itself (its PID)...
+        - a PID is the process' slot in the table, with the number of times that slot has been reused (its generation) in the bits above PID_SLOT_BITS
+            ex) our first ever process will have a processId of 0
+            ex) our first ever fork will create a child process, which is our second process in our entire simulation; thus, it'll have a processId of 1 (due to 0-indexing)
+            ex) once enough processes have finished for slot 1 to be handed out again, its next process gets a processId of 1 + (1 << PID_SLOT_BITS)
+        - so a PID that was kept around after its process was reaped (a stale PID) doesn't find() the slot's new process
+        - a free slot's processId is already the PID its next process will get
+    3. parentProcessId --> this is the ID of a process' parent if it has one
+        - this will only be set if the process was created via a fork... so every process besides process 0
+    4. startTime / finishTime
+        - these correspond to the start and finish time of a given process (used to calculate turnaround time)
+    5. priority
+        - owned by the scheduling policy (0 is the best) --> the priority scheduler's current priority, or the multi-level feedback queue's level
+        - a forked child starts with its parent's priority
+    6. program
+        - this is a handle to the Program containing ALL the instructions that the current process has and will run
+        - ex) Process 0's program will contain each instruction in the "init" file
+        - the Program itself is shared with every other process running the same file (see ProgramCache), and is empty (NULL) until a program is loaded
+    7. lastCore
+        - the core the process last ran on (-1 if it has never run), so we can count migrations and send an unblocked process back where it ran
+    8. stateSince, waitingTime and hasRun
+        - bookkeeping for SchedulerMetrics: when the process entered its current state, how long it has spent READY so far, and whether it has run yet
+    9. wakeTime
+        - when the timer of a "B <ticks>" instruction will unblock the process (0 if the process isn't waiting on a timer)
+    10. stateNext / statePrev and lists
+        - the links of the StateList each process is on --> lists[state] holds every process in that state
+        - setState() moves a process from one list to another in O(1), so finding the processes in a state (ex: reporterProcess()) or a specific blocked process (ex: "U 7") never needs a scan of the table
+        - lists[STATE_FREE] is the free list --> slots that release() took back, oldest first
+- allocate() hands out a slot off the free list if there is one, and only grows the table when there isn't
+    - so a workload that keeps forking and finishing processes keeps the table at the size of its peak number of processes, not its total
+    - the table holds at most PID_SLOTS processes at a time
+- created --> the number of processes allocate() has handed out over the whole run
 */
-bool createProgram(const string &filename, vector<Instruction> &program) {
-    ifstream file;
-    int lineNum = 0;
-    file.open(filename.c_str());
-    if (!file.is_open()) {
-        cout << "Error opening file " << filename << endl;
-        return false;
-    }
-    while (file.good()) {
-      string line;
-      getline(file, line);
-      trim(line);
-      if (line.size() > 0) {
-          Instruction instruction;
-          instruction.operation = toupper(line[0]);
-          instruction.stringArg = trim(line.erase(0, 1));
-          stringstream argStream(instruction.stringArg);
-          switch (instruction.operation) {
-              case 'S': // Integer argument.
-              case 'A': // Integer argument.
-              case 'D': // Integer argument.
-              case 'F': // Integer argument.
-                  if (!(argStream >> instruction.intArg)) {
-                      cout << filename << ":" << lineNum << " - Invalid integer argument " << instruction.stringArg << " for " << instruction.operation << " operation" << endl;
-                      return false;
-                  }
-                  break;
-                  case 'B': // No argument.
-                  case 'E': // No argument
-                    break;
-                  case 'R': // String argument.
-                  // Note that since the string is trimmed on both ends, filenames
-                  // with leading or trailing whitespace (unlikely) will not work.
-                  if (instruction.stringArg.size() == 0) {
-                      cout << filename << ":" << lineNum << " - Missing string argument" << endl;
-                      file.close();
-                      return false;
-                  }
-                  break;
-                  default:
-                      cout << filename << ":" << lineNum << " - Invalid operation, " << instruction.operation << endl;
-                  file.close();
-                  return false;
-              }
-              program.push_back(instruction);
-          }
-          lineNum++;
-    }
-    file.close();
-    return true;
-}
+class PcbTable {
+    public:
+        vector<PcbHot> hot;
+        vector<int> processId;
+        vector<int> parentProcessId;
+        vector<unsigned int> startTime;
+        vector<unsigned int> finishTime;
+        vector<int> priority;
+        vector<ProgramHandle> program;
+        vector<int> lastCore;
+        vector<unsigned int> stateSince;
+        vector<unsigned int> waitingTime;
+        vector<unsigned char> hasRun;
+        vector<unsigned int> wakeTime;
+        vector<int> stateNext;
+        vector<int> statePrev;
+        StateList lists[STATE_FINISHED + 1];
+        unsigned long created;
 
-// creates a reporter process
-void reporterProcess() {
-   cout << "*************************************************************" << endl;
+        PcbTable() : created(0) {}
+
+        // number of PCB slots in the table (free ones included)
+        int size() const {
+            return static_cast<int>(hot.size());
+        }
 
-   cout << "The current value is: " << cpu.value << endl;
+        // number of slots holding a process
+        int live() const {
+            return size() - lists[STATE_FREE].count;
+        }
 
-   cout << "The current process is: " << currentRunningProcessID << endl;
-  
-   cout<< "Processes in READY STATE: ";
-   for(int i = 0; i < readyState.size(); i++) {
-       if(pcbEntry[i].state == STATE_READY) {
-           cout << pcbEntry[i].processId << " ";
-       }
-   }
-   cout << endl;
+        // returns the index of a READY slot for a new process (reusing a free one if there is one), or -1 if the table is full
+        int allocate() {
+            int index = lists[STATE_FREE].head;
+            if (index == -1) {
+                if (size() >= PID_SLOTS) return -1;
+                index = size();
+                PcbHot entry;
+                entry.state = STATE_FREE;
+                hot.push_back(entry);
+                processId.push_back(index);
+                parentProcessId.push_back(-1);
+                startTime.push_back(0);
+                finishTime.push_back(0);
+                priority.push_back(0);
+                program.push_back(ProgramHandle());
+                lastCore.push_back(-1);
+                stateSince.push_back(0);
+                waitingTime.push_back(0);
+                hasRun.push_back(0);
+                wakeTime.push_back(0);
+                stateNext.push_back(-1);
+                statePrev.push_back(-1);
+                link(index);
+            }
+            hot[index].programCounter = 0;
+            hot[index].value = 0;
+            parentProcessId[index] = -1;
+            startTime[index] = 0;
+            finishTime[index] = 0;
+            priority[index] = 0;
+            lastCore[index] = -1;
+            stateSince[index] = 0;
+            waitingTime[index] = 0;
+            hasRun[index] = 0;
+            wakeTime[index] = 0;
+            setState(index, STATE_READY);
+            created++;
+            return index;
+        }
 
-   cout<< "Processes in BLOCKED STATE: ";
-   for(int i = 0; i < blockedState.size(); i++) {
-       if(pcbEntry[i].state == STATE_BLOCKED) {
-           cout << pcbEntry[i].processId << " ";
-       }
-   }
-   cout << endl;
+        // reaps the (finished) process in slot index --> the slot goes on the free list, and its next process gets the next generation's PID
+        void release(int index) {
+            program[index].reset();
+            unsigned int generation = (static_cast<unsigned int>(processId[index]) >> PID_SLOT_BITS) + 1;
+            processId[index] = index | static_cast<int>((generation % PID_GENERATIONS) << PID_SLOT_BITS);
+            setState(index, STATE_FREE);
+        }
 
-   cout<< "Processes in RUNNING STATE: ";
-   for(int i = 0; i < 10; i++) {
-       if(pcbEntry[i].state == STATE_RUNNING) {
-           cout << pcbEntry[i].processId << " ";
-       }
-   }
-   cout << endl;
+        // returns the slot of the process with the given PID, or -1 if there is none (ex: the PID is stale)
+        int find(int pid) const {
+            int index = pid & (PID_SLOTS - 1);
+            if (pid < 0 || index >= size() || processId[index] != pid || hot[index].state == STATE_FREE) return -1;
+            return index;
+        }
+
+        // the PID of the process in slot index, for printing (-1 stays -1, meaning "no process")
+        int pidOf(int index) const {
+            return index == -1 ? -1 : processId[index];
+        }
+
+        // moves process onto the list of the given state (this is the only way a process' state should change)
+        void setState(int process, State state) {
+            unlink(process);
+            hot[process].state = state;
+            link(process);
+        }
+
+        // drops every PCB slot (and gives the memory back)
+        void clear() {
+            vector<PcbHot>().swap(hot);
+            vector<int>().swap(processId);
+            vector<int>().swap(parentProcessId);
+            vector<unsigned int>().swap(startTime);
+            vector<unsigned int>().swap(finishTime);
+            vector<int>().swap(priority);
+            vector<ProgramHandle>().swap(program);
+            vector<int>().swap(lastCore);
+            vector<unsigned int>().swap(stateSince);
+            vector<unsigned int>().swap(waitingTime);
+            vector<unsigned char>().swap(hasRun);
+            vector<unsigned int>().swap(wakeTime);
+            vector<int>().swap(stateNext);
+            vector<int>().swap(statePrev);
+            for (int state = 0; state <= STATE_FINISHED; state++) {
+                lists[state] = StateList();
+            }
+            created = 0;
+        }
+
+        // approximate number of bytes held by the table itself (not counting the instructions inside each program)
+        size_t memoryUsage() const {
+            return hot.capacity() * sizeof(PcbHot)
+                + processId.capacity() * sizeof(int)
+                + parentProcessId.capacity() * sizeof(int)
+                + startTime.capacity() * sizeof(unsigned int)
+                + finishTime.capacity() * sizeof(unsigned int)
+                + priority.capacity() * sizeof(int)
+                + program.capacity() * sizeof(ProgramHandle)
+                + lastCore.capacity() * sizeof(int)
+                + stateSince.capacity() * sizeof(unsigned int)
+                + waitingTime.capacity() * sizeof(unsigned int)
+                + hasRun.capacity() * sizeof(unsigned char)
+                + wakeTime.capacity() * sizeof(unsigned int)
+                + stateNext.capacity() * sizeof(int)
+                + statePrev.capacity() * sizeof(int);
+        }
+
+    private:
+        // appends process to the tail of the list for its current state
+        void link(int process) {
+            StateList &list = lists[hot[process].state];
+            statePrev[process] = list.tail;
+            stateNext[process] = -1;
+            if (list.tail == -1) {
+                list.head = process;
+            } else {
+                stateNext[list.tail] = process;
+            }
+            list.tail = process;
+            list.count++;
+        }
+
+        // takes process off the list for its current state
+        void unlink(int process) {
+            StateList &list = lists[hot[process].state];
+            int previous = statePrev[process];
+            int next = stateNext[process];
+            if (previous == -1) {
+                list.head = next;
+            } else {
+                stateNext[previous] = next;
+            }
+            if (next == -1) {
+                list.tail = previous;
+            } else {
+                statePrev[next] = previous;
+            }
+            list.count--;
+        }
+};
+
+/*
+Let's setup our simulation --> here's a few important variables
+    1. pcbTable
+        - this will allow us to reference all of our processes
+        - the ID of a process is its slot in the table, and the table grows every time we fork
+    2. timestamp
+        - this is quite literally time --> at the start of our simulation, it'll be at time 0. this value will be incremented as we put in the 'Q' instruction, passing time quantum
+    3. cores
+        - our simulated cores (--cores=N, one by default) --> each has its own running process and its own ready queue
+    4. cpu, currentRunningProcessID and readyState
+        - the core we are currently working on, loaded out of cores by loadCore() and written back by storeCore()
+        - everything that changes the running process (schedule(), block(), fork(), ...) works on these, one core at a time
+        - At all times, currentRunningProcessID is the ID of the process running on that core
+        - since we now have a table of processes, the ID of a process corresponds to it's slot in the table...
+        - readyState is that core's ready queue, in whatever order the scheduling policy chose at startup (see SchedulingPolicy below)
+    5. blocked processes (shared by every core) are pcbTable.lists[STATE_BLOCKED], oldest first
+- every variable that is part of a simulation (these, and the policy, program cache, metrics, timers, ... further down) is thread_local
+    - so each thread has a simulator of its own, and several simulations can run side by side in one process (see "--batch")
+    - the threads that step a simulation's cores (CoreThreads) only ever touch the Cpus they are handed
+*/
+thread_local PcbTable pcbTable;
+thread_local unsigned int timestamp = 0;
+thread_local vector<Cpu> cores;
+thread_local int currentCore = 0;
+thread_local Cpu cpu;
+thread_local int currentRunningProcessID = -1;
+thread_local SchedulingPolicy *readyState = NULL;
 
-   cout << "*************************************************************" << endl;
+// makes core the one cpu, currentRunningProcessID and readyState refer to
+//    - the core's program handle and output buffer are moved rather than copied (no reference counting on every switch)
+void loadCore(int core) {
+    currentCore = core;
+    cpu = move(cores[core]);
+    currentRunningProcessID = cpu.runningProcessID;
+    readyState = cpu.runQueue;
 }
 
-// Implements the S operation.
-void set(int value) {
-    // Set the CPU value to the passed-in value.
-    cpu.value = value;
+// writes the loaded core back into cores
+void storeCore() {
+    cpu.runningProcessID = currentRunningProcessID;
+    cores[currentCore] = move(cpu);
 }
 
-// Implements the A operation.
-void add(int value) {
-    // Add the passed-in value to the CPU value.
-    cpu.value = cpu.value + value;
+/*
+Futex helpers --> how the two sides of a lock-free ring buffer sleep and wake each other (used by RingTransport and Logger)
+*/
+void futexWait(atomic<uint32_t> &word, uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, NULL, NULL, 0);
 }
 
-// Implements the D operation.
-void decrement(int value) {
-    // Subtract the integer value from the CPU value.
-    cpu.value = cpu.value - value;
+void futexWake(atomic<uint32_t> &word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, 1, NULL, NULL, 0);
 }
 
-// Performs scheduling.
-void schedule() {
-    // 1. Return if there is still a processing running (currentRunningProcessID != -1). There is no need to schedule if a process is already running
-    // 2. Get a new process to run, if possible, from the ready queue.
-    // 3. If we were able to get a new process to run:
-    //      a. Mark the processing as running (update the new process's PCB state)
-    //      b. Update the CPU structure with the PCB entry details (program, program counter, value, etc.)
-    int targetProcess;
-    if(currentRunningProcessID != -1) {
-        printf("Process %d is currently running! \n", currentRunningProcessID);
-        return;
-    } else {
-        if(readyState.size() > 0) {
-            // dequeue our readyQueue, store new process
-            targetProcess = readyState.back();
-            readyState.pop_back();
-            
-            // mark process as running
-            pcbEntry[targetProcess].state = STATE_RUNNING;
+// sleeps until index moves away from seen (or the other side closes)
+// we announce ourselves in waiting before re-checking index, and the other side publishes index before checking waiting, so one of us always sees the other
+void waitFor(atomic<uint32_t> &index, uint32_t seen, atomic<uint32_t> &signal, atomic<uint32_t> &waiting, atomic<uint32_t> &closed) {
+    for (int spin = 0; spin < 64; spin++) {
+        if (index.load(memory_order_acquire) != seen || closed.load(memory_order_acquire)) return;
+    }
+    uint32_t signalSeen = signal.load();
+    waiting.store(1);
+    if (index.load() == seen && !closed.load()) {
+        futexWait(signal, signalSeen);
+    }
+    waiting.store(0);
+}
 
-            // update CPU structure with PCB entry details
-            cpu.programCounter = pcbEntry[targetProcess].programCounter;
-            cpu.value = pcbEntry[targetProcess].value;  // IS THIS LINE CORRECT
-            cpu.pProgram = &(pcbEntry[targetProcess].program);
+// wakes the other side if it is asleep (clearing waiting, so a burst of sends only pays for one wake-up syscall)
+void wake(atomic<uint32_t> &signal, atomic<uint32_t> &waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (waiting.load() && waiting.exchange(0)) {
+        signal.fetch_add(1);
+        futexWake(signal);
+    }
+}
 
-            // system is now running...
-            currentRunningProcessID = targetProcess;
+/*
+Here, we've defined how much the process manager tells us as it runs (--log=<level>); each level includes everything from the levels above it
+    1. LOG_SILENT --> nothing at all
+    2. LOG_SUMMARY --> P, M and T reports, and errors
+    3. LOG_TRANSITION --> every fork, block, unblock, replace, preemption and termination
+    4. LOG_INSTRUCTION --> every quantum and every instruction (the default, and what the simulator has always printed)
+*/
+enum LogLevel {
+    LOG_SILENT = 0,
+    LOG_SUMMARY,
+    LOG_TRANSITION,
+    LOG_INSTRUCTION
+};
+
+// how log messages are written out (--log-format=<format>) --> as plain text, or as one JSON object per line ({"time": ..., "level": ..., "message": ...})
+enum LogFormat {
+    LOG_TEXT = 0,
+    LOG_JSONL
+};
+
+// appends text to out, escaped to go between the quotes of a JSON string
+void appendJsonString(string &out, const char *text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        unsigned char ch = static_cast<unsigned char>(text[i]);
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += static_cast<char>(ch);
+        } else if (ch < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+            out += escaped;
         } else {
-            printf("There are no processes in the ready queue. ");
+            out += static_cast<char>(ch);
         }
     }
 }
 
-// Implements the B operation.
-void block() {
-    // 1. Add the PCB index of the running process (stored in currentRunningProcessID) to the blocked queue.
-    // 2. Update the process's PCB entry
-    //    a. Change the PCB's state to blocked.
-    //    b. Store the CPU program counter in the PCB's program counter.
-    //    c. Store the CPU's value in the PCB's value.
-    // 3. Update the running state to -1 (basically mark no process as running). Note that a new process will be chosen to run later (via the Q command code calling the schedule() function).
-    blockedState.push_back(currentRunningProcessID);
+/*
+Logger class definition --> where everything the process manager prints goes
+    - messages are built in pending (see LogLine below) and commit()ted into a lock-free single-producer/single-consumer ring buffer
+    - a background thread drains the ring to stdout (or the --log-file) in large write()s, so the simulation never waits on the terminal (unless the ring fills up)
+    - until start() is called (ex: in the benchmarks), messages are written straight to stdout instead
+    - the logger is thread_local like the rest of the simulation --> so each run of a batch has its own level, format, message and file
+*/
+class Logger {
+    public:
+        static const uint32_t RING_SIZE = 1 << 20; // must be a power of two
 
-    // update the process's PCB entry
-    pcbEntry[currentRunningProcessID].state = STATE_BLOCKED;
-    pcbEntry[currentRunningProcessID].programCounter = cpu.programCounter;
-    pcbEntry[currentRunningProcessID].value = cpu.value;
+        LogLevel level;
+        LogFormat format;
+        string pending; // the message being built
 
-    // mark no process as running
-    currentRunningProcessID = -1;
-}
+        Logger() : level(LOG_INSTRUCTION), format(LOG_TEXT), sink(STDOUT_FILENO), ring(NULL), head(0), consumerSignal(0), consumerWaiting(0),
+                   tail(0), producerSignal(0), producerWaiting(0), stopping(0), neverClosed(0) {}
 
-// Implements the E operation.
-void end() {
-    // 1. Get the PCB entry of the running process.
-    // 2. Update the running state to -1 (basically mark no process as running). Note that a new process will be chosen to run later (via the Q command code calling the schedule function).
+        ~Logger() {
+            stop();
+        }
 
-    pcbEntry[currentRunningProcessID].state = STATE_FINISHED;
+        // starts the background thread that writes to the sink
+        void start() {
+            if (ring != NULL) return;
+            ring = new char[RING_SIZE];
+            stopping.store(0);
+            drainer = thread(&Logger::drain, this);
+        }
 
-    // mark no process as running
-    currentRunningProcessID = -1;
-}
+        // writes out everything logged so far and stops the background thread
+        void stop() {
+            if (ring == NULL) return;
+            stopping.store(1);
+            wake(consumerSignal, consumerWaiting);
+            drainer.join();
+            delete[] ring;
+            ring = NULL;
+        }
 
-// Implements the F operation.
-void fork(int value) {
-    // 1. Get a free PCB index (pcbTable.size())
-    // 2. Get the PCB entry for the current running process.
-    // 3. Ensure the passed-in value is not out of bounds.
-    // 4. Populate the PCB entry obtained in #1
-    //    a. Set the process ID to the PCB index obtained in #1.
-    //    b. Set the parent process ID to the process ID of the running process (use the running process's PCB entry to get this).
-    //    c. Set the program counter to the cpu program counter.
-    //    d. Set the value to the cpu value.
-    //    e. Set the priority to the same as the parent process's priority.
-    //    f. Set the state to the ready state.
-    //    g. Set the start time to the current timestamp
-    // 5. Add the pcb index to the ready queue.
-    // 6. Increment the cpu's program counter by the value read in #3
-    int freePcbIndex;
-    freePcbIndex = numProcesses++;
+        // sends the log to the file at path (created or emptied) instead of stdout, until closeFile() --> call it before start()
+        bool openFile(const string &path) {
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) return false;
+            closeFile();
+            sink = fd;
+            return true;
+        }
 
-    if(value > 0) { // What is considered out of bounds for 'value'
-        // make a new child process --> this will be the new running process
-        pcbEntry[freePcbIndex].processId = freePcbIndex;
-        pcbEntry[freePcbIndex].parentProcessId = pcbEntry[currentRunningProcessID].processId;
-        pcbEntry[freePcbIndex].programCounter = cpu.programCounter;
-        pcbEntry[freePcbIndex].value = cpu.value;
-        pcbEntry[freePcbIndex].state = STATE_RUNNING;
-        pcbEntry[freePcbIndex].startTime = timestamp;
+        // goes back to logging to stdout --> call it after stop()
+        void closeFile() {
+            if (sink != STDOUT_FILENO) close(sink);
+            sink = STDOUT_FILENO;
+        }
 
-        // store the current process' information...
-        pcbEntry[currentRunningProcessID].state = STATE_READY;
-        pcbEntry[currentRunningProcessID].programCounter = cpu.programCounter+1;
+        // hands the message in pending (logged at messageLevel) to the ring, and empties pending
+        void commit(LogLevel messageLevel) {
+            if (format == LOG_JSONL) {
+                string records;
+                size_t start = 0;
+                while (start < pending.size()) {
+                    size_t end = pending.find('\n', start);
+                    if (end == string::npos) end = pending.size();
+                    appendJson(records, messageLevel, pending.data() + start, end - start);
+                    start = end + 1;
+                }
+                write(records.data(), records.size());
+            } else {
+                write(pending.data(), pending.size());
+            }
+            pending.clear();
+        }
 
-        readyState.push_back(currentRunningProcessID);
+    private:
+        int sink; // the file descriptor the log is written to
+        char *ring;
+        thread drainer;
+        alignas(64) atomic<uint32_t> head; // every byte ever logged (moved only by the simulation)
+        atomic<uint32_t> consumerSignal;
+        atomic<uint32_t> consumerWaiting;
+        alignas(64) atomic<uint32_t> tail; // every byte ever written out (moved only by the background thread)
+        atomic<uint32_t> producerSignal;
+        atomic<uint32_t> producerWaiting;
+        atomic<uint32_t> stopping;
+        atomic<uint32_t> neverClosed;
 
-        // update running state to child process
-        currentRunningProcessID = freePcbIndex;
-        // cpu.programCounter += value;
-    }
+        void write(const char *bytes, size_t count) {
+            if (ring == NULL) {
+                if (sink == STDOUT_FILENO) {
+                    fwrite(bytes, 1, count, stdout);
+                    return;
+                }
+                while (count > 0) {
+                    ssize_t written = ::write(sink, bytes, count);
+                    if (written <= 0) return;
+                    bytes += written;
+                    count -= static_cast<size_t>(written);
+                }
+                return;
+            }
+            while (count > 0) {
+                uint32_t position = head.load(memory_order_relaxed);
+                uint32_t written = tail.load(memory_order_acquire);
+                uint32_t space = RING_SIZE - (position - written);
+                if (space == 0) {
+                    // the terminal can't keep up --> wait for the background thread to make room
+                    waitFor(tail, written, producerSignal, producerWaiting, neverClosed);
+                    continue;
+                }
+                uint32_t chunk = count < space ? static_cast<uint32_t>(count) : space;
+                uint32_t offset = position & (RING_SIZE - 1);
+                uint32_t first = chunk < RING_SIZE - offset ? chunk : RING_SIZE - offset;
+                memcpy(ring + offset, bytes, first);
+                memcpy(ring, bytes + first, chunk - first);
+                head.store(position + chunk, memory_order_release);
+                wake(consumerSignal, consumerWaiting);
+                bytes += chunk;
+                count -= chunk;
+            }
+        }
+
+        // the background thread: writes whatever is in the ring to the sink, until stop() is called and the ring is empty
+        void drain() {
+            while (true) {
+                uint32_t position = tail.load(memory_order_relaxed);
+                uint32_t end = head.load(memory_order_acquire);
+                if (position == end) {
+                    if (stopping.load(memory_order_acquire) && head.load(memory_order_acquire) == position) return;
+                    waitFor(head, end, consumerSignal, consumerWaiting, stopping);
+                    continue;
+                }
+                uint32_t offset = position & (RING_SIZE - 1);
+                uint32_t chunk = end - position < RING_SIZE - offset ? end - position : RING_SIZE - offset;
+                ssize_t written = ::write(sink, ring + offset, chunk);
+                // if the sink has gone away there is nobody to tell, so the bytes are dropped
+                if (written <= 0) written = chunk;
+                tail.store(position + static_cast<uint32_t>(written), memory_order_release);
+                wake(producerSignal, producerWaiting);
+            }
+        }
+
+        // appends message (one line, without its newline) to records as a JSON object
+        static void appendJson(string &records, LogLevel messageLevel, const char *message, size_t length) {
+            static const char *const levelNames[] = {"silent", "summary", "transition", "instruction"};
+            records += "{\"time\": " + to_string(timestamp) + ", \"level\": \"" + levelNames[messageLevel] + "\", \"message\": \"";
+            appendJsonString(records, message, length);
+            records += "\"}\n";
+        }
+};
+
+thread_local Logger logger;
+thread_local string logPath; // --log-file=<file> (empty = stdout)
+
+// returns true if messages at level are being logged --> check this first, so a message nobody will see is never even formatted
+bool logging(LogLevel level) {
+    return level <= logger.level;
 }
 
-// Implements the R operation.
-void replace(string &argument) {
-    // 1. Clear the CPU's program (cpu.pProgram->clear()).
-    // 2. Use createProgram() to read in the filename specified by argument into the CPU (*cpu.pProgram)
-    // a. Consider what to do if createProgram fails. I printed an error, incremented the cpu program counter and then returned. Note that createProgram can fail if the file could not be opened or did not exist.
-    // 3. Set the program counter to 0.
-    cpu.pProgram = new vector<Instruction>;
-    bool programSuccess = createProgram(argument, *cpu.pProgram);
-    if(programSuccess == false) {
-        printf("A new program was not able to be created. \n");
-    }
-    cpu.programCounter = 0;
+/*
+Profiler --> where a run's time goes, for when a run is slow and we can't tell why (--profile, dumped by the D command and at T)
+    - it only exists in a build with -DSIM_PROFILE=1 --> otherwise PROFILE_BUILD is false, and every check below folds away at compile time
+    - even in a profiling build it records nothing until --profile turns it on, so the cost is one predictable branch per hook
+    1. per opcode --> how many times each handler ran, and the cycles (rdtsc) of one in every PROFILE_SAMPLE_RATE of them
+        - the counts are kept per core (see CoreProfile), since S, A and D run on the core threads
+    2. per section --> calls of quantum(), stepping the cores, scheduling decisions, preempt(), work stealing, program loads (R), and log output
+        - the cycles of one in every PROFILE_SAMPLE_RATE calls too, since rdtsc itself can cost ~25ns (ex: in a VM)
+        - sections nest, so quantum's cycles include those of everything it calls
+    3. context switches --> dispatches, and the preemptions, blocks, forks and ends that took a process off its core
+    4. with --profile=perf, Linux hardware counters (perf_event_open) for the process manager's thread --> cycles, instructions, cache and branch misses
+*/
+const bool PROFILE_BUILD = SIM_PROFILE != 0;
+const unsigned int PROFILE_SAMPLE_RATE = 64; // must be a power of two
+
+// returns a cycle count (rdtsc), or nanoseconds on machines without one --> only differences between two calls are meaningful
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/*
+CoreProfile class definition --> one core's opcode counters
+    - each core gets its own cache line(s), since the core threads count at the same time
+*/
+class alignas(64) CoreProfile {
+    public:
+        unsigned long executed[OP_COUNT];
+        unsigned long sampled[OP_COUNT];
+        uint64_t cycles[OP_COUNT];
+
+        CoreProfile() {
+            clear();
+        }
+
+        void clear() {
+            memset(executed, 0, sizeof(executed));
+            memset(sampled, 0, sizeof(sampled));
+            memset(cycles, 0, sizeof(cycles));
+        }
+};
+
+enum ProfileSection {
+    PROFILE_QUANTUM = 0,
+    PROFILE_STEP,
+    PROFILE_SCHEDULE,
+    PROFILE_PREEMPT,
+    PROFILE_STEAL,
+    PROFILE_LOAD,
+    PROFILE_OUTPUT,
+    PROFILE_SECTIONS
+};
+
+enum ProfileSwitch {
+    SWITCH_DISPATCH = 0,
+    SWITCH_PREEMPT,
+    SWITCH_BLOCK,
+    SWITCH_FORK,
+    SWITCH_END,
+    SWITCH_KINDS
+};
+
+/*
+HardwareCounters class definition --> a group of perf_event_open() counters, read all at once
+    - open() fails (and leaves error set) wherever the kernel doesn't allow them, ex: in most containers
+*/
+class HardwareCounters {
+    public:
+        enum { CYCLES = 0, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, COUNTERS };
+
+        string error;
+
+        HardwareCounters() {
+            for (int i = 0; i < COUNTERS; i++) fds[i] = -1;
+        }
+
+        ~HardwareCounters() {
+            close();
+        }
+
+        // starts counting on the calling thread
+        bool open() {
+            static const uint64_t configs[COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+            close();
+            for (int i = 0; i < COUNTERS; i++) {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[i];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fds[i] == -1) {
+                    error = strerror(errno);
+                    close();
+                    return false;
+                }
+            }
+            error.clear();
+            return true;
+        }
+
+        void close() {
+            for (int i = 0; i < COUNTERS; i++) {
+                if (fds[i] != -1) ::close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+
+        bool active() const {
+            return fds[0] != -1;
+        }
+
+        // reads every counter into values, returning false if any of them can't be read
+        bool read(uint64_t values[COUNTERS]) const {
+            for (int i = 0; i < COUNTERS; i++) {
+                if (fds[i] == -1 || ::read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) return false;
+            }
+            return true;
+        }
+
+    private:
+        int fds[COUNTERS];
+};
+
+/*
+Profiler class definition --> one simulation's profile (see Profiler above)
+    - reset() starts it over for cores cores, when the process manager starts, and resize() keeps it counting when L restores a run with another number of cores
+*/
+class Profiler {
+    public:
+        bool enabled;  // --profile
+        bool hardware; // --profile=perf
+        vector<CoreProfile> cores;
+        unsigned long calls[PROFILE_SECTIONS];
+        unsigned long sampled[PROFILE_SECTIONS];
+        uint64_t cycles[PROFILE_SECTIONS];
+        unsigned long switches[SWITCH_KINDS];
+        unsigned long foldedQuanta; // quanta run as superinstructions, which never reach a handler
+        HardwareCounters counters;
+        uint64_t startValues[HardwareCounters::COUNTERS];
+
+        Profiler() : enabled(false), hardware(false) {
+            clear();
+        }
+
+        void reset(size_t coreCount) {
+            clear();
+            cores.assign(coreCount, CoreProfile());
+            if (hardware && counters.open()) counters.read(startValues);
+        }
+
+        // keeps counting with coreCount cores --> the cores that are still there keep their counts
+        void resize(size_t coreCount) {
+            cores.resize(coreCount);
+        }
+
+        // counts a call to section, returning true if this is one of the calls to time
+        bool sample(ProfileSection section) {
+            return (calls[section]++ & (PROFILE_SAMPLE_RATE - 1)) == 0;
+        }
+
+        void record(ProfileSection section, uint64_t elapsed) {
+            sampled[section]++;
+            cycles[section] += elapsed;
+        }
+
+    private:
+        void clear() {
+            memset(calls, 0, sizeof(calls));
+            memset(sampled, 0, sizeof(sampled));
+            memset(cycles, 0, sizeof(cycles));
+            memset(switches, 0, sizeof(switches));
+            memset(startValues, 0, sizeof(startValues));
+            foldedQuanta = 0;
+        }
+};
+
+thread_local Profiler profiler;
+
+// whether this build has a profiler and --profile turned it on --> a constant false (so the hook disappears) unless built with -DSIM_PROFILE=1
+inline bool profiling() {
+    return PROFILE_BUILD && profiler.enabled;
+}
+
+// counts a context switch of kind
+inline void profileSwitch(ProfileSwitch kind) {
+    if (profiling()) profiler.switches[kind]++;
+}
+
+/*
+ProfileTimer class definition --> counts a call to one ProfileSection, and (for a sampled call) times the rest of the enclosing scope
+    - ex) ProfileTimer timer(PROFILE_PREEMPT); at the top of preempt()
+*/
+class ProfileTimer {
+    public:
+        ProfileTimer(ProfileSection profileSection) : section(profileSection), start(profiling() && profiler.sample(profileSection) ? readCycles() : 0) {}
+
+        ~ProfileTimer() {
+            if (PROFILE_BUILD && start != 0) profiler.record(section, readCycles() - start);
+        }
+
+    private:
+        ProfileSection section;
+        uint64_t start;
+};
+
+/*
+LogLine class definition --> builds one log message with <<, and commits it to the logger when it goes away (at the end of the statement, for a temporary)
+    - ex) if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << processId << " has been forked. \n";
+    - numbers are formatted the same way cout formats them, so the text is exactly what we used to print
+    - only one LogLine may be alive at a time
+*/
+class LogLine {
+    public:
+        LogLine(LogLevel messageLevel) : level(messageLevel), timer(PROFILE_OUTPUT) {}
+
+        ~LogLine() {
+            logger.commit(level);
+        }
+
+        LogLine &operator<<(const char *text) {
+            logger.pending += text;
+            return *this;
+        }
+
+        LogLine &operator<<(const string &text) {
+            logger.pending += text;
+            return *this;
+        }
+
+        LogLine &operator<<(char ch) {
+            logger.pending += ch;
+            return *this;
+        }
+
+        LogLine &operator<<(int number) {
+            return format("%d", number);
+        }
+
+        LogLine &operator<<(unsigned int number) {
+            return format("%u", number);
+        }
+
+        LogLine &operator<<(long number) {
+            return format("%ld", number);
+        }
+
+        LogLine &operator<<(unsigned long number) {
+            return format("%lu", number);
+        }
+
+        LogLine &operator<<(double number) {
+            return format("%g", number);
+        }
+
+        // appends text formatted like printf() would
+        LogLine &format(const char *text, ...) {
+            char buffer[256];
+            va_list arguments;
+            va_start(arguments, text);
+            int length = vsnprintf(buffer, sizeof(buffer), text, arguments);
+            va_end(arguments);
+            if (length > 0) logger.pending.append(buffer, min(static_cast<size_t>(length), sizeof(buffer) - 1));
+            return *this;
+        }
+
+    private:
+        LogLevel level;
+        ProfileTimer timer;
+};
+
+/*
+SnapshotWriter class definition --> builds a snapshot of the simulation in memory (see Snapshots below)
+    - every value is written as its raw bytes in native byte order, and every array is padded out to a multiple of 8 bytes
+        - so each array in the file is aligned, and SnapshotReader can copy it straight out of the mapping
+*/
+class SnapshotWriter {
+    public:
+        string bytes;
+
+        template <typename T> void put(const T &value) {
+            bytes.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+        // an array is its length (8 bytes) followed by its elements
+        template <typename T> void putArray(const T *values, size_t count) {
+            put<uint64_t>(count);
+            align();
+            bytes.append(reinterpret_cast<const char *>(values), count * sizeof(T));
+            align();
+        }
+
+        template <typename T, typename Allocator> void putVector(const vector<T, Allocator> &values) {
+            putArray(values.data(), values.size());
+        }
+
+        template <typename T> void putDeque(const deque<T> &values) {
+            putVector(vector<T>(values.begin(), values.end()));
+        }
+
+        void putString(const string &text) {
+            putArray(text.data(), text.size());
+        }
+
+        void align() {
+            bytes.resize((bytes.size() + 7) & ~static_cast<size_t>(7), '\0');
+        }
+};
+
+/*
+SnapshotReader class definition --> reads back what a SnapshotWriter wrote, out of a mapped snapshot file
+    - a read past the end of the snapshot (or an array too long to fit in it) fails the reader, and every read after that does nothing
+    - so a restore can read everything and then check ok() once
+*/
+class SnapshotReader {
+    public:
+        SnapshotReader(const char *snapshot, size_t snapshotSize) : data(snapshot), size(snapshotSize), position(0), failed(false) {}
+
+        bool ok() const {
+            return !failed;
+        }
+
+        template <typename T> void get(T &value) {
+            if (!take(sizeof(T))) return;
+            memcpy(&value, data + position - sizeof(T), sizeof(T));
+        }
+
+        // returns the elements of an array, or NULL (with count 0) if the reader failed
+        template <typename T> const T *getArray(size_t &count) {
+            uint64_t length = 0;
+            get(length);
+            align();
+            count = 0;
+            if (failed || length > (size - position) / sizeof(T)) {
+                failed = true;
+                return NULL;
+            }
+            const T *values = reinterpret_cast<const T *>(data + position);
+            position += length * sizeof(T);
+            align();
+            count = static_cast<size_t>(length);
+            return values;
+        }
+
+        template <typename T, typename Allocator> void getVector(vector<T, Allocator> &values) {
+            size_t count;
+            const T *first = getArray<T>(count);
+            if (first == NULL) {
+                values.clear();
+                return;
+            }
+            values.assign(first, first + count);
+        }
+
+        template <typename T> void getDeque(deque<T> &values) {
+            size_t count;
+            const T *first = getArray<T>(count);
+            if (first == NULL) {
+                values.clear();
+                return;
+            }
+            values.assign(first, first + count);
+        }
+
+        void getString(string &text) {
+            size_t count;
+            const char *first = getArray<char>(count);
+            if (first == NULL) {
+                text.clear();
+                return;
+            }
+            text.assign(first, count);
+        }
+
+    private:
+        const char *data;
+        size_t size;
+        size_t position;
+        bool failed;
+
+        bool take(size_t bytes) {
+            if (failed || bytes > size - position) {
+                failed = true;
+                return false;
+            }
+            position += bytes;
+            return true;
+        }
+
+        void align() {
+            size_t aligned = (position + 7) & ~static_cast<size_t>(7);
+            position = aligned < size ? aligned : size;
+        }
+};
+
+/*
+SchedulingPolicy class definition --> decides which ready process runs next, and for how long
+    - every process that becomes ready (forked, unblocked or preempted) is enqueue()d, and schedule() dequeue()s the next one to run
+    - timeSlice() is how many quanta a process may run before quantum() preempts it (0 means it runs until it blocks or ends)
+    - sliceExpired(), blocked() and tick() let a policy adjust priorities as processes use the CPU
+    - save() and restore() write out and read back everything the policy holds, for checkpoints (see Snapshots below)
+*/
+class SchedulingPolicy {
+    public:
+        SchedulingPolicy(unsigned int timeSlice) : slice(timeSlice), sequence(0) {}
+        virtual ~SchedulingPolicy() {}
+
+        virtual void enqueue(int processId) = 0;
+        // removes and returns the process that should run next, or -1 if no process is ready
+        virtual int dequeue() = 0;
+        virtual size_t size() const = 0;
+        // appends every process waiting in the ready queue to out, in no particular order (to check a restored snapshot)
+        virtual void appendReady(vector<int> &out) const = 0;
+
+        virtual unsigned int timeSlice(int processId) const {
+            return slice;
+        }
+
+        // the running process used up its time slice and is about to go back in the ready queue
+        virtual void sliceExpired(int processId) {}
+
+        // the running process blocked before its time slice was up
+        virtual void blocked(int processId) {}
+
+        // called once per quantum, after the timestamp has moved --> runningProcess is the process running on this queue's core (-1 if none)
+        virtual void tick(int runningProcess) {}
+
+        // how many of the coming tick()s are sure to do nothing (so that many quanta can be run in one go, see runSuperinstructions())
+        virtual unsigned long quietTicks() const {
+            return ULONG_MAX;
+        }
+
+        // writes the policy's state (its ready queue, in order) to out
+        virtual void save(SnapshotWriter &out) const {
+            out.put<uint64_t>(sequence);
+        }
+
+        // reads back what save() wrote into a freshly created policy of the same kind
+        virtual void restore(SnapshotReader &in) {
+            uint64_t saved = 0;
+            in.get(saved);
+            sequence = static_cast<unsigned long>(saved);
+        }
+
+    protected:
+        unsigned int slice;
+        unsigned long sequence; // breaks ties in enqueue order
+
+        // a ready process ordered by key, then by when it was enqueued (lowest first)
+        struct HeapEntry {
+            long long key;
+            unsigned long sequence;
+            int processId;
+
+            bool operator>(const HeapEntry &other) const {
+                return key != other.key ? key > other.key : sequence > other.sequence;
+            }
+        };
+        class ReadyHeap : public priority_queue<HeapEntry, vector<HeapEntry>, greater<HeapEntry> > {
+            public:
+                // the entries, in heap order
+                const vector<HeapEntry> &entries() const {
+                    return c;
+                }
+        };
+
+        HeapEntry makeEntry(long long key, int processId) {
+            HeapEntry entry;
+            entry.key = key;
+            entry.sequence = sequence++;
+            entry.processId = processId;
+            return entry;
+        }
+
+        // a heap is saved as its entries in the order they'd be dequeued --> pushing them back in gives a heap that dequeues in exactly that order
+        static void saveHeap(SnapshotWriter &out, ReadyHeap heap) {
+            vector<HeapEntry> entries;
+            entries.reserve(heap.size());
+            while (!heap.empty()) {
+                entries.push_back(heap.top());
+                heap.pop();
+            }
+            out.putVector(entries);
+        }
+
+        static void restoreHeap(SnapshotReader &in, ReadyHeap &heap) {
+            vector<HeapEntry> entries;
+            in.getVector(entries);
+            heap = ReadyHeap();
+            for (size_t i = 0; i < entries.size(); i++) {
+                heap.push(entries[i]);
+            }
+        }
+
+        static void appendHeap(const ReadyHeap &heap, vector<int> &out) {
+            const vector<HeapEntry> &entries = heap.entries();
+            for (size_t i = 0; i < entries.size(); i++) {
+                out.push_back(entries[i].processId);
+            }
+        }
+};
+
+/*
+FifoPolicy --> first come, first served (O(1) enqueue and dequeue)
+    - with a time slice this is round-robin: a preempted process goes to the back of the line
+*/
+class FifoPolicy : public SchedulingPolicy {
+    public:
+        FifoPolicy(unsigned int timeSlice) : SchedulingPolicy(timeSlice) {}
+
+        void enqueue(int processId) {
+            ready.push_back(processId);
+        }
+
+        int dequeue() {
+            if (ready.empty()) return -1;
+            int processId = ready.front();
+            ready.pop_front();
+            return processId;
+        }
+
+        size_t size() const {
+            return ready.size();
+        }
+
+        void appendReady(vector<int> &out) const {
+            out.insert(out.end(), ready.begin(), ready.end());
+        }
+
+        void save(SnapshotWriter &out) const {
+            SchedulingPolicy::save(out);
+            out.putDeque(ready);
+        }
+
+        void restore(SnapshotReader &in) {
+            SchedulingPolicy::restore(in);
+            in.getDeque(ready);
+        }
+
+    private:
+        deque<int> ready;
+};
+
+/*
+LifoPolicy --> the most recently readied process runs first (what schedule() used to do by popping readyState.back())
+*/
+class LifoPolicy : public SchedulingPolicy {
+    public:
+        LifoPolicy(unsigned int timeSlice) : SchedulingPolicy(timeSlice) {}
+
+        void enqueue(int processId) {
+            ready.push_back(processId);
+        }
+
+        int dequeue() {
+            if (ready.empty()) return -1;
+            int processId = ready.back();
+            ready.pop_back();
+            return processId;
+        }
+
+        size_t size() const {
+            return ready.size();
+        }
+
+        void appendReady(vector<int> &out) const {
+            out.insert(out.end(), ready.begin(), ready.end());
+        }
+
+        void save(SnapshotWriter &out) const {
+            SchedulingPolicy::save(out);
+            out.putDeque(ready);
+        }
+
+        void restore(SnapshotReader &in) {
+            SchedulingPolicy::restore(in);
+            in.getDeque(ready);
+        }
+
+    private:
+        deque<int> ready;
+};
+
+/*
+PriorityPolicy --> the process with the best (lowest) priority runs first, with aging so that nobody starves (O(log n))
+    - a process that uses up its time slice drops one priority level, and one that blocks early climbs one level
+    - aging: every agingInterval quanta spent waiting improve a process' effective priority by one level
+        - effective priority = priority - (now - readySince) / agingInterval, so ordering by priority * agingInterval + readySince is the same order at any "now"
+        - that key never changes while the process waits, so a plain heap stays correct as time passes
+*/
+class PriorityPolicy : public SchedulingPolicy {
+    public:
+        static const int LOWEST_PRIORITY = 15;
+
+        PriorityPolicy(unsigned int timeSlice, unsigned int agingQuanta) : SchedulingPolicy(timeSlice), agingInterval(agingQuanta) {}
+
+        void enqueue(int processId) {
+            long long priority = pcbTable.priority[processId];
+            long long key = agingInterval > 0 ? priority * agingInterval + timestamp : priority;
+            ready.push(makeEntry(key, processId));
+        }
+
+        int dequeue() {
+            if (ready.empty()) return -1;
+            int processId = ready.top().processId;
+            ready.pop();
+            return processId;
+        }
+
+        size_t size() const {
+            return ready.size();
+        }
+
+        void appendReady(vector<int> &out) const {
+            appendHeap(ready, out);
+        }
+
+        void sliceExpired(int processId) {
+            if (pcbTable.priority[processId] < LOWEST_PRIORITY) pcbTable.priority[processId]++;
+        }
+
+        void blocked(int processId) {
+            if (pcbTable.priority[processId] > 0) pcbTable.priority[processId]--;
+        }
+
+        void save(SnapshotWriter &out) const {
+            SchedulingPolicy::save(out);
+            saveHeap(out, ready);
+        }
+
+        void restore(SnapshotReader &in) {
+            SchedulingPolicy::restore(in);
+            restoreHeap(in, ready);
+        }
+
+    private:
+        unsigned int agingInterval;
+        ReadyHeap ready;
+};
+
+/*
+MlfqPolicy --> multi-level feedback queue (O(levels) dequeue)
+    - a process' level is its pcbTable.priority; level 0 runs first, and each level down gets twice the time slice of the one above
+    - a process that uses up its whole slice moves down a level
+    - every boostInterval quanta every waiting process (and the running one) goes back to level 0, so long-running processes don't starve
+*/
+class MlfqPolicy : public SchedulingPolicy {
+    public:
+        MlfqPolicy(unsigned int timeSlice, unsigned int numLevels, unsigned int boostQuanta)
+            : SchedulingPolicy(timeSlice > 0 ? timeSlice : 2), levels(numLevels > 0 ? numLevels : 1), boostInterval(boostQuanta), lastBoost(0), count(0) {}
+
+        void enqueue(int processId) {
+            levels[levelOf(processId)].push_back(processId);
+            count++;
+        }
+
+        int dequeue() {
+            for (size_t level = 0; level < levels.size(); level++) {
+                if (!levels[level].empty()) {
+                    int processId = levels[level].front();
+                    levels[level].pop_front();
+                    count--;
+                    return processId;
+                }
+            }
+            return -1;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        void appendReady(vector<int> &out) const {
+            for (size_t level = 0; level < levels.size(); level++) {
+                out.insert(out.end(), levels[level].begin(), levels[level].end());
+            }
+        }
+
+        unsigned int timeSlice(int processId) const {
+            return slice << levelOf(processId);
+        }
+
+        void sliceExpired(int processId) {
+            if (levelOf(processId) + 1 < levels.size()) pcbTable.priority[processId]++;
+        }
+
+        void tick(int runningProcess) {
+            if (boostInterval == 0 || timestamp - lastBoost < boostInterval) return;
+            lastBoost = timestamp;
+            for (size_t level = 1; level < levels.size(); level++) {
+                for (size_t i = 0; i < levels[level].size(); i++) {
+                    pcbTable.priority[levels[level][i]] = 0;
+                    levels[0].push_back(levels[level][i]);
+                }
+                levels[level].clear();
+            }
+            if (runningProcess != -1) pcbTable.priority[runningProcess] = 0;
+        }
+
+        unsigned long quietTicks() const {
+            if (boostInterval == 0) return ULONG_MAX;
+            unsigned long since = timestamp - lastBoost;
+            return since + 1 >= boostInterval ? 0 : boostInterval - since - 1;
+        }
+
+        void save(SnapshotWriter &out) const {
+            SchedulingPolicy::save(out);
+            out.put(lastBoost);
+            for (size_t level = 0; level < levels.size(); level++) {
+                out.putDeque(levels[level]);
+            }
+        }
+
+        void restore(SnapshotReader &in) {
+            SchedulingPolicy::restore(in);
+            in.get(lastBoost);
+            count = 0;
+            for (size_t level = 0; level < levels.size(); level++) {
+                in.getDeque(levels[level]);
+                count += levels[level].size();
+            }
+        }
+
+    private:
+        vector<deque<int> > levels;
+        unsigned int boostInterval;
+        unsigned int lastBoost;
+        size_t count;
+
+        size_t levelOf(int processId) const {
+            size_t level = static_cast<size_t>(pcbTable.priority[processId]);
+            return level < levels.size() ? level : levels.size() - 1;
+        }
+};
+
+/*
+ShortestRemainingPolicy --> the ready process with the fewest instructions left in its program runs first (O(log n))
+    - a process' remaining instruction count can only change while it runs, so its key is fixed while it waits in the heap
+*/
+class ShortestRemainingPolicy : public SchedulingPolicy {
+    public:
+        ShortestRemainingPolicy(unsigned int timeSlice) : SchedulingPolicy(timeSlice) {}
+
+        void enqueue(int processId) {
+            long long remaining = 0;
+            if (pcbTable.program[processId]) {
+                remaining = static_cast<long long>(pcbTable.program[processId]->size()) - pcbTable.hot[processId].programCounter;
+            }
+            ready.push(makeEntry(remaining, processId));
+        }
+
+        int dequeue() {
+            if (ready.empty()) return -1;
+            int processId = ready.top().processId;
+            ready.pop();
+            return processId;
+        }
+
+        size_t size() const {
+            return ready.size();
+        }
+
+        void appendReady(vector<int> &out) const {
+            appendHeap(ready, out);
+        }
+
+        void save(SnapshotWriter &out) const {
+            SchedulingPolicy::save(out);
+            saveHeap(out, ready);
+        }
+
+        void restore(SnapshotReader &in) {
+            SchedulingPolicy::restore(in);
+            restoreHeap(in, ready);
+        }
+
+    private:
+        ReadyHeap ready;
+};
+
+/*
+PolicyOptions class definition --> the scheduling policy picked on the command line, and its knobs
+    1. name --> fifo, lifo, rr, priority, mlfq or sri
+    2. timeSlice --> quanta before a running process is preempted (0 = never; rr defaults to 4 and mlfq to 2 for its top level)
+    3. agingInterval --> (priority) quanta of waiting that buy one level of priority
+    4. levels, boostInterval --> (mlfq) number of levels, and quanta between priority boosts
+*/
+class PolicyOptions {
+    public:
+        string name;
+        unsigned int timeSlice;
+        unsigned int agingInterval;
+        unsigned int levels;
+        unsigned int boostInterval;
+
+        PolicyOptions() : name("fifo"), timeSlice(0), agingInterval(10), levels(3), boostInterval(100) {}
+};
+
+thread_local PolicyOptions policyOptions;
+
+// builds the scheduling policy described by options, or returns NULL if there is no policy by that name
+SchedulingPolicy *createPolicy(const PolicyOptions &options) {
+    if (options.name == "fifo") return new FifoPolicy(options.timeSlice);
+    if (options.name == "lifo") return new LifoPolicy(options.timeSlice);
+    if (options.name == "rr") return new FifoPolicy(options.timeSlice > 0 ? options.timeSlice : 4);
+    if (options.name == "priority") return new PriorityPolicy(options.timeSlice, options.agingInterval);
+    if (options.name == "mlfq") return new MlfqPolicy(options.timeSlice, options.levels, options.boostInterval);
+    if (options.name == "sri") return new ShortestRemainingPolicy(options.timeSlice);
+    return NULL;
+}
+
+/*
+trim() is a function that trims leading and trailing whitespace of an instruction
+    - ex) "     S 1000     " becomes "S 1000"
+*/
+string trim(string &str) {
+    // trim leading whitespace
+    size_t start = str.find_first_not_of(" \t\n\r\f\v");
+    if (start != string::npos) str = str.substr(start);
+
+    // trim trailing whitespace
+    size_t end = str.find_last_not_of(" \t\n\r\f\v");
+    if (end != string::npos) str = str.substr(0, end + 1);
+
+    return str;
+}
+
+/*
+Compiled program files --> a program that has already been decoded, so it can be mapped and run without any parsing
+    - layout (native byte order):
+        1. a CompiledProgramHeader
+        2. opCount Ops, 8 bytes each (the header is a multiple of 8 bytes, so they are aligned in the mapping)
+        3. the string table: stringCount NUL-terminated filenames, in index order
+    - "./skeleton --compile <program> <compiled program>" writes one; createProgram() recognises them by their magic number
+*/
+const char COMPILED_PROGRAM_MAGIC[8] = {'S', 'K', 'E', 'L', 'P', 'R', 'O', 'G'};
+const uint32_t COMPILED_PROGRAM_VERSION = 1;
+
+struct CompiledProgramHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t opCount;
+    uint32_t stringCount;
+    uint32_t stringBytes;
+};
+
+// whitespace, as trim() saw it
+bool isBlank(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v';
+}
+
+/*
+parseIntArg() reads an integer argument the same way "stream >> intArg" used to
+    - an optional sign followed by digits; anything after the digits is ignored
+    - returns false if there are no digits or the number doesn't fit in an int
+*/
+bool parseIntArg(const char *begin, const char *end, int &result) {
+    const char *p = begin;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p == end || !isdigit(static_cast<unsigned char>(*p))) return false;
+    long long number = 0;
+    while (p < end && isdigit(static_cast<unsigned char>(*p))) {
+        number = number * 10 + (*p - '0');
+        if (number > static_cast<long long>(INT_MAX) + 1) return false;
+        p++;
+    }
+    if (negative) number = -number;
+    if (number < INT_MIN || number > INT_MAX) return false;
+    result = static_cast<int>(number);
+    return true;
+}
+
+// decodes the text program in [text, text + size) into program, in one pass and without allocating anything per line
+bool parseProgramText(const string &filename, const char *text, size_t size, Program &program) {
+    const char *end = text + size;
+    const char *line = text;
+    int lineNum = 1;
+    program.ops.reserve(size / 8);
+    while (line < end) {
+        const char *lineEnd = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (lineEnd == NULL) lineEnd = end;
+
+        // trim leading and trailing whitespace
+        const char *first = line;
+        const char *last = lineEnd;
+        while (first < last && isBlank(*first)) first++;
+        while (last > first && isBlank(last[-1])) last--;
+
+        if (first < last) {
+            Instruction instruction;
+            instruction.operation = toupper(*first);
+            instruction.intArg = 0;
+            // the argument is whatever follows the operation, trimmed again
+            const char *arg = first + 1;
+            while (arg < last && isBlank(*arg)) arg++;
+            switch (instruction.operation) {
+                case 'S': // Integer argument.
+                case 'A': // Integer argument.
+                case 'D': // Integer argument.
+                case 'F': // Integer argument.
+                    if (!parseIntArg(arg, last, instruction.intArg)) {
+                        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << ":" << lineNum << " - Invalid integer argument " << string(arg, last) << " for " << instruction.operation << " operation\n";
+                        return false;
+                    }
+                    break;
+                case 'B': // Optional integer argument (the ticks to stay blocked).
+                    if (arg < last && (!parseIntArg(arg, last, instruction.intArg) || instruction.intArg < 0)) {
+                        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << ":" << lineNum << " - Invalid tick count " << string(arg, last) << " for B operation\n";
+                        return false;
+                    }
+                    break;
+                case 'E': // No argument
+                    break;
+                case 'R': // String argument.
+                    // Note that since the string is trimmed on both ends, filenames
+                    // with leading or trailing whitespace (unlikely) will not work.
+                    if (arg == last) {
+                        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << ":" << lineNum << " - Missing string argument\n";
+                        return false;
+                    }
+                    // the only per-instruction string we build --> R's filename goes into the string table
+                    instruction.stringArg.assign(arg, last);
+                    break;
+                default:
+                    if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << ":" << lineNum << " - Invalid operation, " << instruction.operation << "\n";
+                    return false;
+            }
+            program.append(instruction);
+        }
+        line = lineEnd + 1;
+        lineNum++;
+    }
+    return true;
+}
+
+// makes program run the compiled program mapped at memory, without copying its Ops (program takes ownership of the mapping)
+bool adoptCompiledProgram(const string &filename, void *memory, size_t size, Program &program) {
+    const char *bytes = static_cast<const char *>(memory);
+    CompiledProgramHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    size_t opBytes = static_cast<size_t>(header.opCount) * sizeof(Op);
+    if (header.version != COMPILED_PROGRAM_VERSION || sizeof(header) + opBytes + header.stringBytes > size) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << " - Invalid or truncated compiled program\n";
+        return false;
+    }
+    // only the (few) R filenames are copied out; the Ops are run in place
+    const char *stringTable = bytes + sizeof(header) + opBytes;
+    const char *stringEnd = stringTable + header.stringBytes;
+    for (uint32_t i = 0; i < header.stringCount; i++) {
+        const char *terminator = static_cast<const char *>(memchr(stringTable, '\0', stringEnd - stringTable));
+        if (terminator == NULL) {
+            if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << " - Invalid or truncated compiled program\n";
+            return false;
+        }
+        program.strings.push_back(string(stringTable, terminator));
+        stringTable = terminator + 1;
+    }
+    const Op *ops = reinterpret_cast<const Op *>(bytes + sizeof(header));
+    for (uint32_t i = 0; i < header.opCount; i++) {
+        if (ops[i].opcode >= OP_COUNT || (ops[i].opcode == OP_REPLACE && static_cast<uint32_t>(ops[i].arg) >= header.stringCount)) {
+            if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << ":" << i + 1 << " - Invalid operation in compiled program\n";
+            return false;
+        }
+    }
+    program.adoptMapping(memory, size, ops, header.opCount);
+    return true;
+}
+
+/*
+This function creates a process' program for us based on a file
+    - It takes in two parameters
+        1. A file
+            - this file contains a series of instructions
+            - see "init" for an example
+            - it may also be a compiled program (see "Compiled program files" above)
+        2. A reference to the newly-created process' program
+            - recall: this program contains all of the process' instructions
+            - thus, as we read from the file we specify in this function, we'll keep decoding instructions line by line into the program
+    - the file is mmap()ed rather than read through a stream, so a text program is parsed straight out of the page cache
+*/
+bool createProgram(const string &filename, Program &program) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1) {
+        if (fd != -1) close(fd);
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Error opening file " << filename << "\n";
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size == 0) {
+        close(fd);
+        return true;
+    }
+    void *memory = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Error opening file " << filename << "\n";
+        return false;
+    }
+    if (size >= sizeof(CompiledProgramHeader) && memcmp(memory, COMPILED_PROGRAM_MAGIC, sizeof(COMPILED_PROGRAM_MAGIC)) == 0) {
+        if (adoptCompiledProgram(filename, memory, size, program)) return true;
+        munmap(memory, size);
+        return false;
+    }
+    madvise(memory, size, MADV_SEQUENTIAL);
+    bool parsed = parseProgramText(filename, static_cast<const char *>(memory), size, program);
+    munmap(memory, size);
+    return parsed;
+}
+
+// the change an A or D operation makes to the value (0 for anything else)
+int64_t arithmeticDelta(const Op &op) {
+    if (op.opcode == OP_ADD) return op.arg;
+    if (op.opcode == OP_DECREMENT) return -static_cast<int64_t>(op.arg);
+    return 0;
+}
+
+/*
+optimizeProgram() is our optimization pass --> it fills in program's superinstructions (see Superinstruction above)
+    - it runs the first time runSuperinstructions() needs a program's superinstructions, rather than when the program is loaded
+    - one pass backwards for each run's lengths, and one pass forwards for its sums and last S
+    - the Ops themselves aren't touched, so the program runs exactly the same whether or not the superinstructions are used
+*/
+void optimizeProgram(const Program &program) {
+    const Op *ops = program.code();
+    size_t size = program.size();
+    vector<Superinstruction, PoolAllocator<Superinstruction> > &table = program.superinstructions;
+    table.assign(size, Superinstruction());
+    uint32_t length = 0;
+    for (size_t i = size; i-- > 0;) {
+        length = ops[i].opcode <= OP_DECREMENT ? length + 1 : 0;
+        table[i].length = length;
+    }
+    int32_t lastSet = -1;
+    int64_t sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (ops[i].opcode > OP_DECREMENT) {
+            lastSet = -1;
+            sum = 0;
+            table[i].lastSet = -1;
+            table[i].sum = 0;
+            continue;
+        }
+        if (ops[i].opcode == OP_SET) lastSet = static_cast<int32_t>(i);
+        sum += arithmeticDelta(ops[i]);
+        table[i].lastSet = lastSet;
+        table[i].sum = sum;
+    }
+}
+
+// the value after running count (>= 1) operations of program's run, starting at operation first, on value
+int foldArithmetic(const Program &program, size_t first, size_t count, int value) {
+    const Op *ops = program.code();
+    const Superinstruction *table = program.superinstructions.data();
+    size_t last = first + count - 1;
+    int64_t result;
+    int32_t set = table[last].lastSet;
+    if (set >= static_cast<int32_t>(first)) {
+        result = static_cast<int64_t>(ops[set].arg) + (table[last].sum - table[set].sum);
+    } else {
+        result = static_cast<int64_t>(value) + (table[last].sum - (table[first].sum - arithmeticDelta(ops[first])));
+    }
+    // wraps around exactly like the same additions done one at a time
+    return static_cast<int>(static_cast<uint32_t>(result));
+}
+
+// writes program to filename as a compiled program file
+bool writeCompiledProgram(const Program &program, const string &filename) {
+    CompiledProgramHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPILED_PROGRAM_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_PROGRAM_VERSION;
+    header.opCount = static_cast<uint32_t>(program.size());
+    header.stringCount = static_cast<uint32_t>(program.strings.size());
+    for (size_t i = 0; i < program.strings.size(); i++) {
+        header.stringBytes += static_cast<uint32_t>(program.strings[i].size() + 1);
+    }
+    ofstream file(filename.c_str(), ios::binary);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(program.code()), program.size() * sizeof(Op));
+    for (size_t i = 0; i < program.strings.size(); i++) {
+        file.write(program.strings[i].c_str(), program.strings[i].size() + 1);
+    }
+    file.close();
+    return file.good();
+}
+
+// Implements "--compile <program> <compiled program>" --> converts a text program into a compiled program file
+int compileProgram(const string &input, const string &output) {
+    Program program;
+    if (!createProgram(input, program)) return EXIT_FAILURE;
+    if (!writeCompiledProgram(program, output)) {
+        cout << "Error writing file " << output << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "Compiled " << program.size() << " instructions from " << input << " into " << output << endl;
+    return EXIT_SUCCESS;
+}
+
+/*
+ProgramCache class definition --> parses each program file once and hands out shared, read-only copies of it
+    - entries are keyed by path, and remember the file's modification time and size --> if the file changes, the next load() parses it again
+    - processes that loaded the old version keep running it; their handles keep it alive until they let go
+    - the cache itself also holds a handle, so repeatedly R-replacing into the same few files never re-parses them
+    - the cache keeps a program after the last process using it finishes, so a file that processes keep loading and finishing (ex: a fork/exit churn) is parsed once
+        - once it holds more than CACHE_LIMIT programs, release() sweeps out the ones nobody is running (how often is doubled as the cache grows, so sweeps stay O(1) per release)
+    - programs are allocated out of instructionPool, so a program that was swept out and is loaded again reuses the memory it had
+*/
+class ProgramCache {
+    public:
+        unsigned long parses; // number of times we actually had to parse a file
+        unsigned long hits;   // number of loads answered from the cache
+
+        ProgramCache() : parses(0), hits(0), sweepAt(CACHE_LIMIT) {}
+
+        // returns the program in filename, or a NULL handle (after createProgram() has printed why) if it can't be loaded
+        ProgramHandle load(const string &filename) {
+            struct stat info;
+            bool found = stat(filename.c_str(), &info) == 0;
+            if (found) {
+                unordered_map<string, Entry>::iterator cached = entries.find(filename);
+                if (cached != entries.end() && cached->second.sameFile(info)) {
+                    hits++;
+                    return cached->second.program;
+                }
+            }
+            shared_ptr<Program> program = allocate_shared<Program>(PoolAllocator<Program>());
+            program->source = filename;
+            parses++;
+            if (!createProgram(filename, *program)) return ProgramHandle();
+            if (found) {
+                Entry &entry = entries[filename];
+                entry.modified = info.st_mtim;
+                entry.size = info.st_size;
+                entry.program = program;
+            }
+            return program;
+        }
+
+        // lets go of a finished process' handle (the cache keeps its own, until a sweep finds nobody else running the program)
+        void release(ProgramHandle &program) {
+            program.reset();
+            if (entries.size() > sweepAt) sweep();
+        }
+
+        // number of programs the cache is holding on to
+        size_t size() const {
+            return entries.size();
+        }
+
+    private:
+        struct Entry {
+            struct timespec modified;
+            off_t size;
+            ProgramHandle program;
+
+            bool sameFile(const struct stat &info) const {
+                return modified.tv_sec == info.st_mtim.tv_sec && modified.tv_nsec == info.st_mtim.tv_nsec && size == info.st_size;
+            }
+        };
+
+        static const size_t CACHE_LIMIT = 256;
+
+        unordered_map<string, Entry> entries;
+        size_t sweepAt;
+
+        // drops every program only the cache is holding on to
+        void sweep() {
+            for (unordered_map<string, Entry>::iterator entry = entries.begin(); entry != entries.end();) {
+                if (entry->second.program.use_count() == 1) {
+                    entry = entries.erase(entry);
+                } else {
+                    ++entry;
+                }
+            }
+            sweepAt = 2 * entries.size() > CACHE_LIMIT ? 2 * entries.size() : CACHE_LIMIT;
+        }
+};
+
+thread_local ProgramCache programCache;
+
+/*
+LogHistogram class definition --> a streaming histogram of non-negative integers (ex: times in quanta), O(1) per value
+    - values below 16 get a bucket each; above that, every power of two is split into 16 buckets, so a bucket is never more than ~6% wide
+    - percentile() walks the (fixed number of) buckets, so querying costs the same however many values were recorded
+*/
+class LogHistogram {
+    public:
+        static const int SUB_BUCKET_BITS = 4;
+        static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const int BUCKETS = SUB_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+        LogHistogram() {
+            clear();
+        }
+
+        void clear() {
+            memset(counts, 0, sizeof(counts));
+            total = 0;
+            sum = 0;
+            maximum = 0;
+        }
+
+        void record(uint64_t value) {
+            counts[bucketOf(value)]++;
+            total++;
+            sum += value;
+            if (value > maximum) maximum = value;
+        }
+
+        uint64_t count() const {
+            return total;
+        }
+
+        double mean() const {
+            return total > 0 ? static_cast<double>(sum) / total : 0;
+        }
+
+        uint64_t max() const {
+            return maximum;
+        }
+
+        // the value below which fraction (0 to 1) of the recorded values fall, to within the width of a bucket
+        uint64_t percentile(double fraction) const {
+            if (total == 0) return 0;
+            // the rank of the value we want, rounded up (ex: the p99 of 4 values is the 4th)
+            double exactRank = fraction * total;
+            uint64_t rank = static_cast<uint64_t>(exactRank);
+            if (rank < exactRank || rank < 1) rank++;
+            uint64_t seen = 0;
+            for (int bucket = 0; bucket < BUCKETS; bucket++) {
+                seen += counts[bucket];
+                if (seen >= rank) return min(middleOf(bucket), maximum);
+            }
+            return maximum;
+        }
+
+    private:
+        uint64_t counts[BUCKETS];
+        uint64_t total;
+        uint64_t sum;
+        uint64_t maximum;
+
+        static int bucketOf(uint64_t value) {
+            if (value < static_cast<uint64_t>(SUB_BUCKETS)) return static_cast<int>(value);
+            int exponent = 63 - __builtin_clzll(value);
+            int shift = exponent - SUB_BUCKET_BITS;
+            return SUB_BUCKETS + shift * SUB_BUCKETS + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+        }
+
+        static uint64_t middleOf(int bucket) {
+            if (bucket < SUB_BUCKETS) return static_cast<uint64_t>(bucket);
+            int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+            uint64_t sub = static_cast<uint64_t>((bucket - SUB_BUCKETS) % SUB_BUCKETS);
+            uint64_t lowest = (SUB_BUCKETS + sub) << shift;
+            return lowest + ((uint64_t(1) << shift) >> 1);
+        }
+};
+
+/*
+SchedulerMetrics class definition --> scheduling statistics, kept up to date on every state transition (so reading them never needs a scan of the PCB table)
+    1. turnaround --> finish time - start time, for every finished process
+    2. waiting --> total time a finished process spent in the READY state
+    3. response --> time from a process' creation to the first time it ran
+    4. readyTime / blockedTime --> the length of every stay in the READY / BLOCKED state, recorded as the process leaves it
+    5. finished, and the number of processes in each state
+- the functions that change a process' state call transition() just before they do (or started() for a new process)
+*/
+class SchedulerMetrics {
+    public:
+        LogHistogram turnaround;
+        LogHistogram waiting;
+        LogHistogram response;
+        LogHistogram readyTime;
+        LogHistogram blockedTime;
+        unsigned long finished;
+        unsigned long inState[STATE_FINISHED + 1];
+
+        SchedulerMetrics() {
+            clear();
+        }
+
+        void clear() {
+            turnaround.clear();
+            waiting.clear();
+            response.clear();
+            readyTime.clear();
+            blockedTime.clear();
+            finished = 0;
+            memset(inState, 0, sizeof(inState));
+        }
+
+        // process was just created, in whatever state its PCB entry says
+        void started(int process) {
+            pcbTable.stateSince[process] = timestamp;
+            pcbTable.waitingTime[process] = 0;
+            pcbTable.hasRun[process] = 0;
+            State state = pcbTable.hot[process].state;
+            inState[state]++;
+            if (state == STATE_RUNNING) ran(process);
+        }
+
+        // process is about to move from the state its PCB entry says to next
+        void transition(int process, State next) {
+            State previous = pcbTable.hot[process].state;
+            unsigned int stay = timestamp - pcbTable.stateSince[process];
+            if (previous == STATE_READY) {
+                readyTime.record(stay);
+                pcbTable.waitingTime[process] += stay;
+            } else if (previous == STATE_BLOCKED) {
+                blockedTime.record(stay);
+            }
+            if (next == STATE_RUNNING && !pcbTable.hasRun[process]) ran(process);
+            if (next == STATE_FINISHED) {
+                turnaround.record(timestamp - pcbTable.startTime[process]);
+                waiting.record(pcbTable.waitingTime[process]);
+                finished++;
+            }
+            inState[previous]--;
+            inState[next]++;
+            pcbTable.stateSince[process] = timestamp;
+        }
+
+        // finished processes per quantum, over the whole run
+        double throughput() const {
+            return timestamp > 0 ? static_cast<double>(finished) / timestamp : 0;
+        }
+
+    private:
+        void ran(int process) {
+            response.record(timestamp - pcbTable.startTime[process]);
+            pcbTable.hasRun[process] = 1;
+        }
+};
+
+thread_local SchedulerMetrics metrics;
+
+/*
+Traces --> a recording of a run of the process manager: every command it was given, and every state transition that followed
+    - "--record=<trace>" writes one, and "--replay <trace>" runs the same commands again and checks that the same transitions happen
+    - a trace is a TraceHeader (the options the run used) followed by TraceEvents, in the order they happened
+*/
+enum TraceEventKind {
+    TRACE_COMMAND = 0, // a command read by the process manager
+    TRACE_SCHEDULE,    // schedule() dispatched process onto core
+    TRACE_PREEMPT,     // process used up its time slice and went back to the ready queue
+    TRACE_BLOCK,       // process ran a B operation; arg is its tick count (0 if it waits for a U)
+    TRACE_UNBLOCK,     // a U command moved process back to core's ready queue
+    TRACE_FORK,        // process forked; arg is the child
+    TRACE_REPLACE,     // process ran an R operation; arg is the new program's size (-1 if it couldn't be loaded)
+    TRACE_END          // process finished
+};
+
+/*
+TraceEvent class definition --> one entry of a trace (24 bytes)
+    1. kind --> a TraceEventKind
+    2. operation / argKind --> for commands, the Command's operation and argKind
+    3. timestamp --> the simulated time it happened at
+    4. core / process / arg --> for transitions, where it happened, to whom, and the detail described by kind
+        - for commands, arg is the Command's intArg
+*/
+class TraceEvent {
+    public:
+        uint8_t kind;
+        uint8_t operation;
+        uint8_t argKind;
+        uint8_t padding;
+        uint32_t timestamp;
+        int32_t core;
+        int32_t process;
+        int64_t arg;
+};
+
+class Command;
+
+/*
+TraceRecorder class definition --> what the process manager tells about each command and transition while a trace is being recorded or replayed
+    - see TraceWriter and TraceReplayer below
+*/
+class TraceRecorder {
+    public:
+        virtual ~TraceRecorder() {}
+        virtual void command(const Command &command) = 0;
+        virtual void transition(const TraceEvent &event) = 0;
+};
+
+// the recorder of the current run (NULL unless we are recording or replaying a trace)
+thread_local TraceRecorder *tracer = NULL;
+
+// tells the tracer (if there is one) that process went through a transition on the loaded core
+void traceTransition(TraceEventKind kind, int process, long long arg) {
+    if (tracer == NULL) return;
+    TraceEvent event;
+    memset(&event, 0, sizeof(event));
+    event.kind = static_cast<uint8_t>(kind);
+    event.timestamp = timestamp;
+    event.core = currentCore;
+    event.process = process;
+    event.arg = arg;
+    tracer->transition(event);
+}
+
+// returns the number of ready processes, over every core's ready queue
+size_t readyCount() {
+    size_t count = 0;
+    for (size_t core = 0; core < cores.size(); core++) {
+        count += cores[core].runQueue->size();
+    }
+    return count;
+}
+
+// appends the ID of every process on list to report (oldest first)
+void reportStateList(LogLine &report, const StateList &list) {
+    for (int i = list.head; i != -1; i = pcbTable.stateNext[i]) {
+        report << pcbTable.processId[i] << " ";
+    }
+    report << "\n";
+}
+
+// creates a reporter process
+//    - the processes in each state come straight off pcbTable's state lists, so this costs time in the number of live processes rather than the size of the table
+void reporterProcess() {
+   if (!logging(LOG_SUMMARY)) return;
+   LogLine report(LOG_SUMMARY);
+   report << "*************************************************************\n";
+
+   if (cores.size() == 1) {
+       report << "The current value is: " << cores[0].value << "\n";
+
+       report << "The current process is: " << pcbTable.pidOf(cores[0].runningProcessID) << "\n";
+   } else {
+       for (size_t core = 0; core < cores.size(); core++) {
+           report << "Core " << core << " --> current process: " << pcbTable.pidOf(cores[core].runningProcessID) << ", current value: " << cores[core].value << "\n";
+       }
+   }
+  
+   report << "Processes in READY STATE: ";
+   reportStateList(report, pcbTable.lists[STATE_READY]);
+
+   report << "Processes in BLOCKED STATE: ";
+   reportStateList(report, pcbTable.lists[STATE_BLOCKED]);
+
+   report << "Processes in RUNNING STATE: ";
+   reportStateList(report, pcbTable.lists[STATE_RUNNING]);
+
+   report << "*************************************************************\n";
+}
+
+// Implements the S operation.
+void set(Cpu &core, int value) {
+    // Set the CPU value to the passed-in value.
+    core.value = value;
+}
+
+// Implements the A operation.
+void add(Cpu &core, int value) {
+    // Add the passed-in value to the CPU value.
+    core.value = core.value + value;
+}
+
+// Implements the D operation.
+void decrement(Cpu &core, int value) {
+    // Subtract the integer value from the CPU value.
+    core.value = core.value - value;
+}
+
+/*
+TimerWheel class definition --> the pending wake-ups of processes blocked by "B <ticks>", kept in a hierarchical timing wheel
+    - there are LEVELS wheels of SLOTS slots each --> a timer sits on the level of the highest byte in which its deadline differs from now, in the slot given by that byte of the deadline
+        ex) level 0 holds the timers due within the current 256 ticks, level 1 the ones due within the current 65536 ticks, ...
+    - when now reaches a slot on a higher level, the timers in it are put back on the wheel (cascaded), which moves each one down at least a level
+        - so add() is O(1), and a timer is moved at most LEVELS times before it fires, no matter how far away its deadline was
+    - nextDeadline() finds the earliest timer from the first occupied slot, without walking the ticks in between --> this is what lets the process manager jump over idle stretches
+    - a timer is never taken off the wheel early: whoever reads the fired timers must check they still mean something (see expireTimers())
+*/
+class Timer {
+    public:
+        int process;
+        unsigned int deadline;
+};
+
+class TimerWheel {
+    public:
+        TimerWheel() {
+            clear();
+        }
+
+        // drops every timer and sets the wheel's clock back to 0
+        void clear() {
+            for (int level = 0; level < LEVELS; level++) {
+                for (int slot = 0; slot < SLOTS; slot++) {
+                    vector<Timer>().swap(wheel[level][slot]);
+                }
+            }
+            due.clear();
+            now = 0;
+            count = 0;
+            earliestKnown = false;
+        }
+
+        // number of timers that haven't fired yet
+        size_t pending() const {
+            return count;
+        }
+
+        // arms a timer that fires for process at deadline (on the next advance() if deadline has already passed)
+        void add(int process, unsigned int deadline) {
+            Timer timer;
+            timer.process = process;
+            timer.deadline = deadline;
+            place(timer);
+            count++;
+            if (earliestKnown && deadline < earliest) earliest = deadline;
+        }
+
+        // sets deadline to the earliest deadline of any pending timer, returning false if there are none
+        bool nextDeadline(unsigned int &deadline) {
+            if (count == 0) return false;
+            if (!earliestKnown) {
+                earliest = findEarliest();
+                earliestKnown = true;
+            }
+            deadline = earliest;
+            return true;
+        }
+
+        // moves the wheel's clock forward to time, appending every timer due by then to fired (earliest first)
+        void advance(unsigned int time, vector<Timer> &fired) {
+            unsigned int next;
+            while (nextDeadline(next) && next <= time) {
+                if (next > now) moveTo(next);
+                fired.insert(fired.end(), due.begin(), due.end());
+                count -= due.size();
+                due.clear();
+                earliestKnown = false;
+            }
+            if (time > now) moveTo(time);
+        }
+
+        // appends every timer on the wheel to out, in no particular order
+        void appendTimers(vector<Timer> &out) const {
+            for (int level = 0; level < LEVELS; level++) {
+                for (int slot = 0; slot < SLOTS; slot++) {
+                    out.insert(out.end(), wheel[level][slot].begin(), wheel[level][slot].end());
+                }
+            }
+            out.insert(out.end(), due.begin(), due.end());
+        }
+
+        // writes every timer to out, slot by slot --> so timers due at the same time still fire in the same order once restored
+        void save(SnapshotWriter &out) const {
+            out.put(now);
+            for (int level = 0; level < LEVELS; level++) {
+                for (int slot = 0; slot < SLOTS; slot++) {
+                    out.putVector(wheel[level][slot]);
+                }
+            }
+            out.putVector(due);
+        }
+
+        void restore(SnapshotReader &in) {
+            clear();
+            in.get(now);
+            for (int level = 0; level < LEVELS; level++) {
+                for (int slot = 0; slot < SLOTS; slot++) {
+                    in.getVector(wheel[level][slot]);
+                    count += wheel[level][slot].size();
+                }
+            }
+            in.getVector(due);
+            count += due.size();
+        }
+
+    private:
+        static const int LEVELS = 4;
+        static const int SLOT_BITS = 8;
+        static const int SLOTS = 1 << SLOT_BITS;
+
+        vector<Timer> wheel[LEVELS][SLOTS];
+        vector<Timer> due; // timers whose deadline is now (or has passed)
+        unsigned int now;
+        size_t count;
+        unsigned int earliest; // cached nextDeadline(), valid while earliestKnown
+        bool earliestKnown;
+
+        // puts timer in its slot for the current now
+        void place(const Timer &timer) {
+            if (timer.deadline <= now) {
+                due.push_back(timer);
+                return;
+            }
+            unsigned int differs = timer.deadline ^ now;
+            int level = LEVELS - 1;
+            while (level > 0 && (differs >> (level * SLOT_BITS)) == 0) level--;
+            wheel[level][(timer.deadline >> (level * SLOT_BITS)) & (SLOTS - 1)].push_back(timer);
+        }
+
+        // moves now forward to time (no timer may be due before time), cascading every slot that time has reached
+        void moveTo(unsigned int time) {
+            unsigned int previous = now;
+            now = time;
+            for (int level = LEVELS - 1; level >= 0; level--) {
+                int shift = level * SLOT_BITS;
+                if (level > 0 && (previous >> shift) == (time >> shift)) continue;
+                vector<Timer> &slot = wheel[level][(time >> shift) & (SLOTS - 1)];
+                if (slot.empty()) continue;
+                vector<Timer> timers;
+                timers.swap(slot);
+                for (size_t i = 0; i < timers.size(); i++) {
+                    place(timers[i]);
+                }
+            }
+        }
+
+        // the earliest deadline on the wheel --> every timer on a lower level is due before any timer on a higher one, so it is in the first occupied slot
+        unsigned int findEarliest() const {
+            unsigned int deadline = now;
+            if (!due.empty()) return deadline;
+            for (int level = 0; level < LEVELS; level++) {
+                int shift = level * SLOT_BITS;
+                for (int slot = ((now >> shift) & (SLOTS - 1)) + 1; slot < SLOTS; slot++) {
+                    const vector<Timer> &timers = wheel[level][slot];
+                    if (timers.empty()) continue;
+                    deadline = timers[0].deadline;
+                    for (size_t i = 1; i < timers.size(); i++) {
+                        if (timers[i].deadline < deadline) deadline = timers[i].deadline;
+                    }
+                    return deadline;
+                }
+            }
+            return deadline;
+        }
+};
+
+/*
+Here are the timers of the current run
+    1. timers --> one timer per "B <ticks>" instruction that has run
+    2. armedTimers --> how many blocked processes are still waiting on their timer
+        - a process unblocked by a U before its timer fires stops waiting (its wakeTime goes back to 0), but its timer stays on the wheel until it fires and is ignored
+*/
+thread_local TimerWheel timers;
+thread_local unsigned long armedTimers = 0;
+thread_local vector<Timer> firedTimers;
+
+// Performs scheduling.
+void schedule() {
+    // 1. Return if there is still a processing running (currentRunningProcessID != -1). There is no need to schedule if a process is already running
+    // 2. Get a new process to run, if possible, from the ready queue.
+    // 3. If we were able to get a new process to run:
+    //      a. Mark the processing as running (update the new process's PCB state)
+    //      b. Update the CPU structure with the PCB entry details (program, program counter, value, etc.)
+    int targetProcess;
+    if(currentRunningProcessID != -1) {
+        if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "Process " << pcbTable.processId[currentRunningProcessID] << " is currently running! \n";
+        return;
+    } else {
+        if(readyState->size() > 0) {
+            ProfileTimer timer(PROFILE_SCHEDULE);
+            // dequeue our readyQueue (the policy decides who is next), store new process
+            targetProcess = readyState->dequeue();
+
+            // mark process as running
+            metrics.transition(targetProcess, STATE_RUNNING);
+            pcbTable.setState(targetProcess, STATE_RUNNING);
+
+            // a process that last ran on another core has migrated here
+            if (pcbTable.lastCore[targetProcess] != -1 && pcbTable.lastCore[targetProcess] != currentCore) {
+                cpu.migrations++;
+            }
+            pcbTable.lastCore[targetProcess] = currentCore;
+
+            // update CPU structure with PCB entry details
+            cpu.programCounter = pcbTable.hot[targetProcess].programCounter;
+            cpu.value = pcbTable.hot[targetProcess].value;  // IS THIS LINE CORRECT
+            cpu.program = pcbTable.program[targetProcess];
+            cpu.pProgram = cpu.program ? cpu.program.get() : &emptyProgram;
+            cpu.sliceUsed = 0;
+
+            // system is now running...
+            currentRunningProcessID = targetProcess;
+            traceTransition(TRACE_SCHEDULE, targetProcess, 0);
+            profileSwitch(SWITCH_DISPATCH);
+        } else {
+            if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "There are no processes in the ready queue. ";
+        }
+    }
+}
+
+// Implements the B and B <ticks> operations --> with ticks > 0, a timer unblocks the process once ticks quanta have passed
+void block(int ticks) {
+    // 1. Move the running process (stored in currentRunningProcessID) to the blocked list, behind every process already blocked.
+    // 2. Update the process's PCB entry
+    //    a. Change the PCB's state to blocked.
+    //    b. Store the CPU program counter in the PCB's program counter.
+    //    c. Store the CPU's value in the PCB's value.
+    // 3. Update the running state to -1 (basically mark no process as running). Note that a new process will be chosen to run later (via the Q command code calling the schedule() function).
+    // update the process's PCB entry
+    metrics.transition(currentRunningProcessID, STATE_BLOCKED);
+    pcbTable.setState(currentRunningProcessID, STATE_BLOCKED);
+    pcbTable.hot[currentRunningProcessID].programCounter = cpu.programCounter;
+    pcbTable.hot[currentRunningProcessID].value = cpu.value;
+    readyState->blocked(currentRunningProcessID);
+    if (ticks > 0) {
+        // the clock is 32 bits, so a deadline past its end is held at the last tick --> it can't wrap around to 0, which means "no timer"
+        unsigned int deadline = static_cast<unsigned int>(min<unsigned long long>(static_cast<unsigned long long>(timestamp) + ticks, UINT_MAX));
+        pcbTable.wakeTime[currentRunningProcessID] = deadline;
+        timers.add(currentRunningProcessID, deadline);
+        armedTimers++;
+    }
+    traceTransition(TRACE_BLOCK, currentRunningProcessID, ticks);
+    profileSwitch(SWITCH_BLOCK);
+
+    // mark no process as running
+    currentRunningProcessID = -1;
+}
+
+// Preempts the running process once it has used up its time slice.
+void preempt() {
+    // 1. Save the CPU's program counter and value in the process's PCB entry (a context switch, just like block()).
+    // 2. Let the policy know the slice was used up, then put the process back in the ready queue.
+    // 3. Mark no process as running, so that schedule() picks whoever is next.
+    ProfileTimer timer(PROFILE_PREEMPT);
+    if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[currentRunningProcessID] << " has been preempted. \n";
+    metrics.transition(currentRunningProcessID, STATE_READY);
+    pcbTable.setState(currentRunningProcessID, STATE_READY);
+    pcbTable.hot[currentRunningProcessID].programCounter = cpu.programCounter;
+    pcbTable.hot[currentRunningProcessID].value = cpu.value;
+    readyState->sliceExpired(currentRunningProcessID);
+    readyState->enqueue(currentRunningProcessID);
+    traceTransition(TRACE_PREEMPT, currentRunningProcessID, 0);
+    profileSwitch(SWITCH_PREEMPT);
+    currentRunningProcessID = -1;
+}
+
+// how many finished processes keep their PCB slot (--retain-finished=<n>) --> past that, the one that finished first is reaped so its slot can be reused
+thread_local int retainFinished = 1024;
+
+// Implements the E operation.
+void end() {
+    // 1. Get the PCB entry of the running process.
+    // 2. Update the running state to -1 (basically mark no process as running). Note that a new process will be chosen to run later (via the Q command code calling the schedule function).
+
+    metrics.transition(currentRunningProcessID, STATE_FINISHED);
+    pcbTable.setState(currentRunningProcessID, STATE_FINISHED);
+    traceTransition(TRACE_END, currentRunningProcessID, 0);
+    profileSwitch(SWITCH_END);
+
+    // the process no longer needs its program (this frees it if we were the last process running it)
+    cpu.program.reset();
+    cpu.pProgram = &emptyProgram;
+    programCache.release(pcbTable.program[currentRunningProcessID]);
+
+    // reap the oldest finished processes, so their slots go back on the free list
+    while (pcbTable.lists[STATE_FINISHED].count > retainFinished) {
+        pcbTable.release(pcbTable.lists[STATE_FINISHED].head);
+    }
+
+    // mark no process as running
+    currentRunningProcessID = -1;
+}
+
+// Implements the F operation.
+void fork(int value) {
+    // 1. Get a free PCB index (pcbTable.allocate() reuses a reaped slot, or grows the table by one) --> it also gives the child its PID
+    // 2. Get the PCB entry for the current running process.
+    // 3. Ensure the passed-in value is not out of bounds.
+    //    - a value that isn't positive doesn't fork at all
+    //    - the parent can't be moved past the end of its program (where it just ends), so a huge value can't overflow its program counter either
+    // 4. Populate the PCB entry obtained in #1
+    //    a. Set the process ID to the PCB index obtained in #1.
+    //    b. Set the parent process ID to the process ID of the running process (use the running process's PCB entry to get this).
+    //    c. Share the parent's program (copy-on-write: programs are immutable, so an R in either process just points that process at another one).
+    //    d. Set the program counter to the cpu program counter (the instruction right after F).
+    //    e. Set the value to the cpu value.
+    //    f. Set the priority to the same as the parent process's priority.
+    //    g. Set the state to the running state (the child runs first).
+    //    h. Set the start time to the current timestamp
+    // 5. Add the parent to the ready queue, with its program counter moved value instructions past the F (so "F 1" resumes right after the instruction following F).
+    // - nothing here depends on the length of the program, so a fork takes constant time however big the image is
+    int freePcbIndex;
+
+    if(value > 0) {
+        freePcbIndex = pcbTable.allocate();
+        if (freePcbIndex == -1) {
+            if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "The process table is full, so process " << pcbTable.processId[currentRunningProcessID] << " could not fork. \n";
+            return;
+        }
+
+        // make a new child process --> this will be the new running process
+        pcbTable.parentProcessId[freePcbIndex] = pcbTable.processId[currentRunningProcessID];
+        pcbTable.program[freePcbIndex] = cpu.program;
+        pcbTable.hot[freePcbIndex].programCounter = cpu.programCounter;
+        pcbTable.hot[freePcbIndex].value = cpu.value;
+        pcbTable.setState(freePcbIndex, STATE_RUNNING);
+        pcbTable.startTime[freePcbIndex] = timestamp;
+        pcbTable.priority[freePcbIndex] = pcbTable.priority[currentRunningProcessID];
+        pcbTable.lastCore[freePcbIndex] = currentCore;
+        metrics.started(freePcbIndex);
+
+        // store the current process' information (this is a context switch, so the value has to be saved too)...
+        metrics.transition(currentRunningProcessID, STATE_READY);
+        pcbTable.setState(currentRunningProcessID, STATE_READY);
+        int64_t resume = static_cast<int64_t>(cpu.programCounter) + value;
+        int64_t programEnd = static_cast<int64_t>(cpu.pProgram->size());
+        pcbTable.hot[currentRunningProcessID].programCounter = static_cast<unsigned int>(resume < programEnd ? resume : programEnd);
+        pcbTable.hot[currentRunningProcessID].value = cpu.value;
+
+        readyState->enqueue(currentRunningProcessID);
+        traceTransition(TRACE_FORK, currentRunningProcessID, freePcbIndex);
+        profileSwitch(SWITCH_FORK);
+
+        // update running state to child process (with a fresh time slice)
+        currentRunningProcessID = freePcbIndex;
+        cpu.sliceUsed = 0;
+    }
+}
+
+// Implements the R operation.
+void replace(const string &argument) {
+    // 1. Get the program for the filename specified by argument from the program cache (it is only parsed if we haven't seen that file before).
+    // a. Consider what to do if createProgram fails. I printed an error, incremented the cpu program counter and then returned. Note that createProgram can fail if the file could not be opened or did not exist.
+    // 2. Swap it into the running process' PCB entry and the CPU (argument may belong to the old program, so it has to be loaded first).
+    // 3. Set the program counter to 0.
+    ProgramHandle program;
+    {
+        ProfileTimer timer(PROFILE_LOAD);
+        program = programCache.load(argument);
+    }
+    if(!program) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "A new program was not able to be created. \n";
+    }
+    pcbTable.program[currentRunningProcessID] = program;
+    cpu.program = program;
+    cpu.pProgram = program ? program.get() : &emptyProgram;
+    cpu.programCounter = 0;
+    traceTransition(TRACE_REPLACE, currentRunningProcessID, program ? static_cast<long long>(program->size()) : -1);
+}
+
+/*
+Op handlers --> one function per opcode, each running a single decoded instruction on a core
+    - quantum() dispatches through opHandlers[op.opcode], so there is no switch and the Op itself is never copied
+    - S, A and D only touch their own core, so they run on the core threads and write what they print into core.output
+    - B, E, F and R change the process table and the ready queues, so quantum() runs them one core at a time, on the loaded cpu
+*/
+typedef void (*OpHandler)(Cpu &core, const Op &op);
+
+void executeSet(Cpu &core, const Op &op) {
+    set(core, op.arg);
+    if (logging(LOG_INSTRUCTION)) core.output += "Instruction S " + to_string(op.arg) + "\n";
+}
+
+void executeAdd(Cpu &core, const Op &op) {
+    add(core, op.arg);
+    if (logging(LOG_INSTRUCTION)) core.output += "Instruction A " + to_string(op.arg) + "\n";
+}
+
+void executeDecrement(Cpu &core, const Op &op) {
+    decrement(core, op.arg);
+    if (logging(LOG_INSTRUCTION)) core.output += "Instruction D " + to_string(op.arg) + "\n";
+}
+
+void executeBlock(Cpu &core, const Op &op) {
+    if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "Instruction B " << op.arg << "\n";
+    if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[currentRunningProcessID] << " has now been blocked. \n";
+    block(op.arg);
+}
+
+void executeEnd(Cpu &core, const Op &op) {
+    pcbTable.finishTime[currentRunningProcessID] = timestamp;
+    if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[currentRunningProcessID] << " has been terminated. \n";
+    end();
+}
+
+void executeFork(Cpu &core, const Op &op) {
+    if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "Instruction F " << op.arg << "\n";
+    if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[currentRunningProcessID] << " has been forked. \n";
+    fork(op.arg);
+    if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[currentRunningProcessID] << " will begin running. \n";
+}
+
+void executeReplace(Cpu &core, const Op &op) {
+    // replace() only lets go of the old program (and so this filename) after it has loaded the new one
+    const string &filename = core.pProgram->strings[op.arg];
+    if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "Instruction R " << filename << "\n";
+    if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[currentRunningProcessID] << " has been replaced. \n";
+    replace(filename);
+}
+
+// indexed by Opcode --> must stay in the same order as the enum
+const OpHandler opHandlers[OP_COUNT] = {
+    executeSet,
+    executeAdd,
+    executeDecrement,
+    executeBlock,
+    executeEnd,
+    executeFork,
+    executeReplace
+};
+
+// what we run when a program runs off its end without an E operation
+const Op endOfProgramOp = {OP_END, {0, 0, 0}, 0};
+
+// runs op on core like opHandlers would, counting it in the core's profile and timing one in every PROFILE_SAMPLE_RATE of them
+void runProfiled(Cpu &core, const Op &op) {
+    CoreProfile &profile = *core.profile;
+    if ((profile.executed[op.opcode]++ & (PROFILE_SAMPLE_RATE - 1)) != 0) {
+        opHandlers[op.opcode](core, op);
+        return;
+    }
+    uint64_t start = readCycles();
+    opHandlers[op.opcode](core, op);
+    profile.cycles[op.opcode] += readCycles() - start;
+    profile.sampled[op.opcode]++;
+}
+
+// fetches the next instruction of the process running on core and runs it if it only touches the core (S, A or D)
+//    - anything else is left in core.pendingOp for quantum() to run once every core has stepped
+//    - this runs on the core threads, so it must not touch anything shared
+void stepCore(Cpu &core) {
+    const Op *op;
+    core.quantumProcessID = core.runningProcessID;
+    core.pendingOp = NULL;
+    if (core.runningProcessID == -1) return;
+    if (core.programCounter < core.pProgram->size()) {
+        op = &core.pProgram->code()[core.programCounter];
+        ++core.programCounter;
+    } else {
+        if (logging(LOG_INSTRUCTION)) core.output += "End of program reached without E operation. " + to_string(core.pProgram->size()) + "\n";
+        op = &endOfProgramOp;
+    }
+    ++core.sliceUsed;
+    ++core.busyQuanta;
+    if (op->opcode <= OP_DECREMENT) {
+        if (profiling()) {
+            runProfiled(core, *op);
+        } else {
+            opHandlers[op->opcode](core, *op);
+        }
+    } else {
+        core.pendingOp = op;
+    }
+}
+
+/*
+Lockstep stepping --> how quantum() runs many cores (LOCKSTEP_MIN_CORES or more) whose processes run the same program
+    - forked processes share their program, so runs of neighbouring cores often sit at the same programCounter (each with its own value)
+    1. phase 1 --> each such run is a group, and a group whose next instruction is S, A or D runs it on all of its values at once
+        - the values are gathered into one contiguous array, updated by an AVX2 kernel (or the scalar one, on a CPU without AVX2), and scattered back
+        - a group with fewer than LOCKSTEP_MIN_GROUP running cores (idle cores don't count), or whose next instruction is B, F, R or E, is stepped by stepCore() as usual
+        - with more than one core thread this is left to stepAll(), which already splits the cores up
+    2. phase 3 --> a core that keeps running its process is ticked and checked in place, rather than loaded and stored back
+        - its ready queue's tick() is given the core's own running process, as it would be once the core is loaded
+    - it only applies when nothing is printed per instruction, and the simulation runs exactly as it would one core at a time (--lockstep=off)
+*/
+thread_local bool useLockstep = true; // --lockstep=on|off
+const size_t LOCKSTEP_MIN_CORES = 16;
+const size_t LOCKSTEP_MIN_GROUP = 8; // one AVX2 vector of values
+
+typedef void (*LockstepKernel)(int32_t *values, size_t count, uint8_t opcode, int32_t arg);
+
+// runs the S, A or D with argument arg on count values, exactly as set(), add() and decrement() would
+void lockstepScalar(int32_t *values, size_t count, uint8_t opcode, int32_t arg) {
+    if (opcode == OP_SET) {
+        for (size_t i = 0; i < count; i++) values[i] = arg;
+    } else if (opcode == OP_ADD) {
+        for (size_t i = 0; i < count; i++) values[i] = values[i] + arg;
+    } else {
+        for (size_t i = 0; i < count; i++) values[i] = values[i] - arg;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// lockstepScalar(), eight values at a time
+__attribute__((target("avx2"))) void lockstepAvx2(int32_t *values, size_t count, uint8_t opcode, int32_t arg) {
+    __m256i operand = _mm256_set1_epi32(arg);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i *lane = reinterpret_cast<__m256i *>(values + i);
+        if (opcode == OP_SET) {
+            _mm256_storeu_si256(lane, operand);
+        } else if (opcode == OP_ADD) {
+            _mm256_storeu_si256(lane, _mm256_add_epi32(_mm256_loadu_si256(lane), operand));
+        } else {
+            _mm256_storeu_si256(lane, _mm256_sub_epi32(_mm256_loadu_si256(lane), operand));
+        }
+    }
+    lockstepScalar(values + i, count - i, opcode, arg);
+}
+#endif
+
+// the fastest kernel this CPU can run
+LockstepKernel bestLockstepKernel() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) return lockstepAvx2;
+#endif
+    return lockstepScalar;
+}
+
+/*
+LockstepStepper class definition --> phase 1 of quantum() in lockstep groups (see Lockstep stepping above)
+    - values is kept from one quantum to the next, so a quantum allocates nothing
+*/
+class LockstepStepper {
+    public:
+        LockstepKernel kernel;
+        unsigned long groupedSteps; // instructions run by the kernel rather than by stepCore()
+
+        LockstepStepper() : kernel(bestLockstepKernel()), groupedSteps(0) {}
+
+        // runs stepCore() on every core, or its equivalent for the ones in a lockstep group
+        void step(vector<Cpu> &cores) {
+            size_t first = 0;
+            while (first < cores.size()) {
+                const Cpu &leader = cores[first];
+                size_t last = first + 1;
+                while (last < cores.size() && cores[last].pProgram == leader.pProgram && cores[last].programCounter == leader.programCounter) last++;
+                stepGroup(cores, first, last);
+                first = last;
+            }
+        }
+
+    private:
+        vector<int32_t> values;
+
+        // steps the cores [first, last), which all share a program and programCounter
+        void stepGroup(vector<Cpu> &cores, size_t first, size_t last) {
+            const Cpu &leader = cores[first];
+            const Op *op = static_cast<size_t>(leader.programCounter) < leader.pProgram->size() ? &leader.pProgram->code()[leader.programCounter] : NULL;
+            // only the running cores count towards the group; idle ones just ride along
+            values.clear();
+            if (op != NULL && op->opcode <= OP_DECREMENT) {
+                for (size_t i = first; i < last; i++) {
+                    const Cpu &core = cores[i];
+                    if (core.runningProcessID != -1) values.push_back(core.value);
+                }
+            }
+            if (values.size() < LOCKSTEP_MIN_GROUP) {
+                for (size_t i = first; i < last; i++) stepCore(cores[i]);
+                return;
+            }
+            kernel(values.data(), values.size(), op->opcode, op->arg);
+            groupedSteps += values.size();
+            size_t next = 0;
+            for (size_t i = first; i < last; i++) {
+                Cpu &core = cores[i];
+                if (core.runningProcessID == -1) {
+                    stepCore(core);
+                    continue;
+                }
+                // the same bookkeeping as stepCore()
+                core.quantumProcessID = core.runningProcessID;
+                core.pendingOp = NULL;
+                core.value = values[next++];
+                ++core.programCounter;
+                ++core.sliceUsed;
+                ++core.busyQuanta;
+                if (profiling()) core.profile->executed[op->opcode]++;
+            }
+        }
+};
+
+thread_local LockstepStepper lockstep;
+
+/*
+CoreThreads class definition --> the OS threads that step the simulated cores in lockstep
+    - stepAll() wakes every worker, has each step its share of the cores (core k goes to thread k % threads, the calling thread being thread 0), and returns once they all have
+    - with a single thread there are no workers at all, and stepAll() just steps every core itself
+    - the logger and profiler are thread_local, so each round hands the workers the simulation's log level and whether it is profiling (S, A and D check both)
+*/
+class CoreThreads {
+    public:
+        // steps simulated --> the cores of the simulation on the thread that constructs it, since the workers can't look up a thread_local themselves
+        CoreThreads(vector<Cpu> &simulated) : stepped(simulated), stride(1), generation(0), remaining(0), stopping(false), level(LOG_INSTRUCTION), profiled(false) {}
+
+        ~CoreThreads() {
+            stop();
+        }
+
+        // starts count - 1 workers (the thread calling stepAll() is the last one)
+        void start(unsigned int count) {
+            stop();
+            stopping = false;
+            stride = max(1u, count);
+            for (unsigned int index = 1; index < count; index++) {
+                workers.push_back(thread(&CoreThreads::work, this, index, generation));
+            }
+        }
+
+        void stop() {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wakeWorkers.notify_all();
+            for (size_t i = 0; i < workers.size(); i++) {
+                workers[i].join();
+            }
+            workers.clear();
+        }
+
+        size_t size() const {
+            return workers.size() + 1;
+        }
+
+        // runs stepCore() on every core
+        void stepAll() {
+            if (workers.empty()) {
+                stepShare(0);
+                return;
+            }
+            {
+                lock_guard<mutex> guard(lock);
+                generation++;
+                remaining = static_cast<unsigned int>(workers.size());
+                level = logger.level;
+                profiled = profiler.enabled;
+            }
+            wakeWorkers.notify_all();
+            stepShare(0);
+            unique_lock<mutex> guard(lock);
+            workersDone.wait(guard, [this] { return remaining == 0; });
+        }
+
+    private:
+        vector<Cpu> &stepped;
+        unsigned int stride; // threads stepping cores, the calling one included --> fixed before any worker starts
+        vector<thread> workers;
+        mutex lock;
+        condition_variable wakeWorkers;
+        condition_variable workersDone;
+        unsigned long generation;
+        unsigned int remaining;
+        bool stopping;
+        LogLevel level;   // the simulation's logger.level for this round
+        bool profiled;    // the simulation's profiler.enabled for this round
+
+        void stepShare(unsigned int index) {
+            for (size_t core = index; core < stepped.size(); core += stride) {
+                stepCore(stepped[core]);
+            }
+        }
+
+        // seen starts at the generation current when the worker was started, so a restarted pool doesn't step a round that already ran
+        void work(unsigned int index, unsigned long seen) {
+            while (true) {
+                {
+                    unique_lock<mutex> guard(lock);
+                    wakeWorkers.wait(guard, [this, seen] { return stopping || generation != seen; });
+                    if (stopping) return;
+                    seen = generation;
+                    logger.level = level;
+                    profiler.enabled = profiled;
+                }
+                stepShare(index);
+                lock_guard<mutex> guard(lock);
+                if (--remaining == 0) workersDone.notify_one();
+            }
+        }
+};
+
+thread_local CoreThreads coreThreads(cores);
+thread_local unsigned int coreCount = 1;   // --cores=N
+thread_local unsigned int threadCount = 0; // --threads=N (0 = one per core, up to the number of hardware threads)
+
+// starts over with coreCount idle cores, each with an empty ready queue built from policyOptions, and loads core 0 --> the profile is left counting
+void rebuildCores() {
+    for (size_t core = 0; core < cores.size(); core++) {
+        delete cores[core].runQueue;
+    }
+    cores.assign(coreCount, Cpu());
+    if (profiling()) profiler.resize(cores.size());
+    for (size_t core = 0; core < cores.size(); core++) {
+        cores[core].runQueue = createPolicy(policyOptions);
+        cores[core].profile = profiling() ? &profiler.cores[core] : NULL;
+    }
+    unsigned int threads = threadCount > 0 ? threadCount : max(1u, thread::hardware_concurrency());
+    coreThreads.start(min(threads, coreCount));
+    cpu = Cpu();
+    loadCore(0);
+}
+
+// rebuildCores(), with the profile started over too
+void resetCores() {
+    if (profiling()) profiler.reset(coreCount);
+    rebuildCores();
+}
+
+// returns true if any core is running a process
+bool anyCoreRunning() {
+    for (size_t core = 0; core < cores.size(); core++) {
+        if (cores[core].runningProcessID != -1) return true;
+    }
+    return false;
+}
+
+// an idle core with nothing in its ready queue takes the next ready process of the core with the longest ready queue
+void stealWork() {
+    if (currentRunningProcessID != -1 || readyState->size() > 0) return;
+    int victim = -1;
+    size_t longest = 0;
+    for (size_t core = 0; core < cores.size(); core++) {
+        if (static_cast<int>(core) != currentCore && cores[core].runQueue->size() > longest) {
+            victim = static_cast<int>(core);
+            longest = cores[core].runQueue->size();
+        }
+    }
+    if (victim != -1) {
+        ProfileTimer timer(PROFILE_STEAL);
+        readyState->enqueue(cores[victim].runQueue->dequeue());
+    }
+}
+
+// Implements the Q command.
+void unblock(int targetProcess);
+
+// unblocks every process whose "B <ticks>" timer is due by the current timestamp (in deadline order)
+void expireTimers() {
+    timers.advance(timestamp, firedTimers);
+    for (size_t i = 0; i < firedTimers.size(); i++) {
+        int process = firedTimers[i].process;
+        // a process that was unblocked by hand has stopped waiting (or is waiting on a newer timer)
+        if (pcbTable.hot[process].state == STATE_BLOCKED && pcbTable.wakeTime[process] == firedTimers[i].deadline) {
+            unblock(process);
+        }
+    }
+    firedTimers.clear();
 }
 
-// Implements the Q command.
 void quantum() {
-    Instruction instruction;
-    cout << "We've moved forward one quantum time. " << timestamp << endl;
-    if (currentRunningProcessID == -1) {
-        cout << "No processes are running. " << endl;
+    ProfileTimer timer(PROFILE_QUANTUM);
+    if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "We've moved forward one quantum time. " << timestamp << "\n";
+    if (timers.pending() > 0) expireTimers();
+    if (!anyCoreRunning()) {
+        if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "No processes are running. \n";
         ++timestamp;
         return;
     }
-    if (cpu.programCounter < cpu.pProgram->size()) {
-        instruction = (*cpu.pProgram)[cpu.programCounter];
-        ++cpu.programCounter;
-    } else {
-    cout << "End of program reached without E operation. " << cpu.pProgram->size() << endl;
-    instruction.operation = 'E';
+    bool lockstepping = useLockstep && cores.size() >= LOCKSTEP_MIN_CORES && !logging(LOG_INSTRUCTION);
+    // 1. every running core fetches its next instruction (and runs it, if it is S, A or D) at the same time --> in lockstep groups, with many cores on one thread
+    {
+        ProfileTimer timer(PROFILE_STEP);
+        if (lockstepping && coreThreads.size() == 1) {
+            lockstep.step(cores);
+        } else {
+            coreThreads.stepAll();
+        }
+    }
+    // 2. one core at a time: print what the core did, and run the instruction it left pending
+    for (size_t core = 0; core < cores.size(); core++) {
+        if (cores[core].quantumProcessID == -1) continue;
+        if (logging(LOG_INSTRUCTION)) {
+            LogLine(LOG_INSTRUCTION) << (cores.size() > 1 ? "Core " + to_string(core) + ":\n" : string()) << cores[core].output;
+            cores[core].output.clear();
+        }
+        if (cores[core].pendingOp != NULL) {
+            loadCore(static_cast<int>(core));
+            if (profiling()) {
+                runProfiled(cpu, *cpu.pendingOp);
+            } else {
+                opHandlers[cpu.pendingOp->opcode](cpu, *cpu.pendingOp);
+            }
+            cpu.pendingOp = NULL;
+            storeCore();
+        }
+    }
+    ++timestamp;
+    // 3. one core at a time: preempt, steal work if idle, and schedule
+    //    - in lockstep, a core that keeps running its process is ticked and checked in place --> it is only loaded if its process has to be preempted
+    for (size_t core = 0; core < cores.size(); core++) {
+        if (lockstepping && cores[core].runningProcessID != -1) {
+            Cpu &state = cores[core];
+            state.runQueue->tick(state.runningProcessID);
+            if (state.quantumProcessID != state.runningProcessID) continue;
+            unsigned int slice = state.runQueue->timeSlice(state.runningProcessID);
+            if (slice == 0 || state.sliceUsed < slice) continue;
+            if (state.runQueue->size() == 0) {
+                state.sliceUsed = 0;
+                continue;
+            }
+            loadCore(static_cast<int>(core));
+            preempt();
+        } else {
+            loadCore(static_cast<int>(core));
+            readyState->tick(currentRunningProcessID);
+            // a process that is still running after using up its time slice makes way for the next ready process (if there is one)
+            int runningProcess = cpu.quantumProcessID;
+            if (runningProcess != -1 && currentRunningProcessID == runningProcess) {
+                unsigned int slice = readyState->timeSlice(runningProcess);
+                if (slice > 0 && cpu.sliceUsed >= slice) {
+                    if (readyState->size() > 0) {
+                        preempt();
+                    } else {
+                        cpu.sliceUsed = 0;
+                    }
+                }
+            }
+        }
+        stealWork();
+        schedule();
+        storeCore();
+    }
+}
+
+// Implements the U command --> unblocks the process in slot targetProcess, or the process that has been blocked the longest if it is -1
+void unblock(int targetProcess) {
+    const StateList &blocked = pcbTable.lists[STATE_BLOCKED];
+    // if blocked list contains no processes, print message accordingly
+    if (blocked.count == 0) {
+        if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "There are no currently blocked processes to unblock. \n";
+    } else if (targetProcess != -1 && pcbTable.hot[targetProcess].state != STATE_BLOCKED) {
+        if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[targetProcess] << " is not blocked. \n";
+    } else { // otherwise, unblock 
+        // 1. If the blocked list contains any processes:
+        //    a. Pick the process asked for, or the one at the front of the blocked list.
+        //    b. Add the process to the ready queue.
+        //    c. Change the state of the process to ready (update its PCB entry) --> this also takes it off the blocked list.
+        // 2. Call the schedule() function to give an unblocked process a chance to run (if possible).
+
+        // pick the process at the front of the list, unless we were given one
+        if (targetProcess == -1) targetProcess = blocked.head;
+
+        // it no longer waits on its timer (if it had one)
+        if (pcbTable.wakeTime[targetProcess] != 0) {
+            pcbTable.wakeTime[targetProcess] = 0;
+            armedTimers--;
+        }
+
+        // it goes back to the core it last ran on, unless that core is busy and another one is idle
+        int core = pcbTable.lastCore[targetProcess];
+        if (core == -1 || cores[core].runningProcessID != -1) {
+            for (size_t idle = 0; idle < cores.size(); idle++) {
+                if (cores[idle].runningProcessID == -1) {
+                    core = static_cast<int>(idle);
+                    break;
+                }
+            }
+        }
+        loadCore(core == -1 ? 0 : core);
+
+        // add that removed process to the ready queue
+        readyState->enqueue(targetProcess);
+
+        // set the state of the process to ready
+        metrics.transition(targetProcess, STATE_READY);
+        pcbTable.setState(targetProcess, STATE_READY);
+        traceTransition(TRACE_UNBLOCK, targetProcess, 0);
+
+        // call the schedule() function...
+        schedule();
+        storeCore();
+        if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pcbTable.processId[targetProcess] <<  " has now been unblocked. \n";
+    }
+}
+// Implements the U <pid> command --> pid has to be the PID of a live process (a stale PID, whose slot was reaped and reused, is never blocked)
+void unblockProcess(unsigned long pid) {
+    int process = pid <= static_cast<unsigned long>(INT_MAX) ? pcbTable.find(static_cast<int>(pid)) : -1;
+    if (process == -1 && pcbTable.lists[STATE_BLOCKED].count > 0) {
+        if (logging(LOG_TRANSITION)) LogLine(LOG_TRANSITION) << "Process " << pid << " is not blocked. \n";
+    } else {
+        unblock(process);
+    }
+}
+
+// Implements the P command.
+void print() {
+    reporterProcess();
+}
+
+/*
+skipIdleTime() is the discrete-event half of the batched Q commands
+    - when no core is running a process, every ready queue is empty and some blocked process is waiting on a timer, nothing can happen until that timer fires
+    - so instead of running idle quanta one at a time, the clock jumps straight to the earliest deadline (but never past limit) and the due timers fire
+    - returns the number of quanta skipped --> an idle stretch costs O(timers) rather than O(ticks)
+*/
+unsigned long skipIdleTime(unsigned long limit) {
+    unsigned long start = timestamp;
+    unsigned int deadline;
+    while (armedTimers > 0 && timestamp < limit && !anyCoreRunning() && readyCount() == 0 && timers.nextDeadline(deadline)) {
+        if (deadline > timestamp) {
+            unsigned int target = static_cast<unsigned int>(min<unsigned long>(deadline, limit));
+            if (logging(LOG_INSTRUCTION)) LogLine(LOG_INSTRUCTION) << "No processes are running, so we skip ahead " << (target - timestamp) << " quanta to time " << target << "\n";
+            timestamp = target;
+            if (timestamp < deadline) break;
+        }
+        expireTimers();
+    }
+    return timestamp - start;
+}
+
+// whether the batched Q commands may run arithmetic with superinstructions (--superinstructions=on|off)
+thread_local bool useSuperinstructions = true;
+
+/*
+runSuperinstructions() is the other fast path of the batched Q commands, for when every running core is in the middle of a run of S, A and D
+    - those quanta can't change anything but the running cores' values and program counters, as long as
+        - nothing is printed per instruction (the log level is below instruction)
+        - no running core uses up its time slice, and no policy's tick() would do anything
+        - no timer comes due, and no idle core could pick up a ready process
+    - so it works out how many quanta (up to limit) all of that holds for, and runs them in one step with each program's superinstructions
+    - timestamp, sliceUsed and busyQuanta move exactly as if the quanta had been run one at a time
+    - returns the number of quanta it ran (0 if the fast path doesn't apply)
+*/
+unsigned long runSuperinstructions(unsigned long limit) {
+    if (!useSuperinstructions || logging(LOG_INSTRUCTION)) return 0;
+    unsigned long quanta = limit;
+    bool running = false;
+    bool idle = false;
+    for (size_t core = 0; core < cores.size(); core++) {
+        const Cpu &state = cores[core];
+        quanta = min(quanta, state.runQueue->quietTicks());
+        if (state.runningProcessID == -1) {
+            idle = true;
+            continue;
+        }
+        running = true;
+        const Program &program = *state.pProgram;
+        if (static_cast<size_t>(state.programCounter) >= program.size()) return 0;
+        if (program.superinstructions.empty()) optimizeProgram(program);
+        quanta = min<unsigned long>(quanta, program.superinstructions[state.programCounter].length);
+        // quantum() checks the slice after every quantum, so stop one short of the quantum that would use it up
+        unsigned int slice = state.runQueue->timeSlice(state.runningProcessID);
+        if (slice > 0) quanta = min<unsigned long>(quanta, slice > state.sliceUsed + 1 ? slice - state.sliceUsed - 1 : 0);
+    }
+    if (!running || (idle && readyCount() > 0)) return 0;
+    unsigned int deadline;
+    if (timers.nextDeadline(deadline)) quanta = min<unsigned long>(quanta, deadline > timestamp ? deadline - timestamp : 0);
+    if (quanta == 0) return 0;
+    for (size_t core = 0; core < cores.size(); core++) {
+        Cpu &state = cores[core];
+        if (state.runningProcessID == -1) continue;
+        state.value = foldArithmetic(*state.pProgram, state.programCounter, quanta, state.value);
+        state.programCounter += static_cast<int>(quanta);
+        state.sliceUsed += static_cast<unsigned int>(quanta);
+        state.busyQuanta += quanta;
+    }
+    timestamp += static_cast<unsigned int>(quanta);
+    if (profiling()) profiler.foldedQuanta += quanta;
+    return quanta;
+}
+
+// Implements the Q <n> command --> runs n quanta back to back, exactly as if Q had been entered n times (idle stretches and arithmetic are skipped over)
+void runQuanta(unsigned long count) {
+    while (count > 0) {
+        count -= skipIdleTime(timestamp + count);
+        if (count == 0) break;
+        unsigned long folded = runSuperinstructions(count);
+        if (folded > 0) {
+            count -= folded;
+            continue;
+        }
+        quantum();
+        count--;
+    }
+}
+
+// Implements the Q * command --> runs quanta until no core is running a process, every ready queue is empty and no timer is left to unblock anyone
+// (processes blocked without a timer still need a U, so this stops once everything left is blocked or finished)
+void runUntilIdle() {
+    while (anyCoreRunning() || readyCount() > 0 || armedTimers > 0) {
+        skipIdleTime(ULONG_MAX);
+        if (!anyCoreRunning() && readyCount() == 0) continue;
+        if (runSuperinstructions(ULONG_MAX) > 0) continue;
+        quantum();
+    }
+}
+
+// Implements the Q @<t> command --> runs quanta until the timestamp reaches t (idle stretches and arithmetic are skipped over)
+void runUntilTimestamp(unsigned long target) {
+    while (timestamp < target) {
+        if (skipIdleTime(target) > 0) continue;
+        if (runSuperinstructions(target - timestamp) > 0) continue;
+        quantum();
+    }
+}
+
+// the average turnaround time of the processes that have finished (0 if none have) --> kept up to date by metrics, so this is O(1)
+double averageTurnaroundTime() {
+    return metrics.turnaround.mean();
+}
+
+// appends one row of the metrics table to report
+void reportHistogram(LogLine &report, const char *name, const LogHistogram &histogram) {
+    report.format("%-14s %-10lu %-10.2f %-8lu %-8lu %-8lu %lu\n", name, static_cast<unsigned long>(histogram.count()), histogram.mean(),
+                  static_cast<unsigned long>(histogram.percentile(0.50)), static_cast<unsigned long>(histogram.percentile(0.95)),
+                  static_cast<unsigned long>(histogram.percentile(0.99)), static_cast<unsigned long>(histogram.max()));
+}
+
+// Implements the M command --> prints the scheduling metrics so far (all times in quanta)
+void printMetrics() {
+    if (!logging(LOG_SUMMARY)) return;
+    LogLine report(LOG_SUMMARY);
+    report << "*************************************************************\n";
+    report << "Metrics at time " << timestamp << ": " << metrics.inState[STATE_RUNNING] << " running, " << metrics.inState[STATE_READY] << " ready, "
+           << metrics.inState[STATE_BLOCKED] << " blocked, " << metrics.finished << " finished\n";
+    report << "Throughput: " << metrics.throughput() << " processes finished per quantum\n";
+    report.format("%-14s %-10s %-10s %-8s %-8s %-8s %s\n", "", "count", "mean", "p50", "p95", "p99", "max");
+    reportHistogram(report, "Turnaround", metrics.turnaround);
+    reportHistogram(report, "Waiting", metrics.waiting);
+    reportHistogram(report, "Response", metrics.response);
+    reportHistogram(report, "Time READY", metrics.readyTime);
+    reportHistogram(report, "Time BLOCKED", metrics.blockedTime);
+    report << "*************************************************************\n";
+}
+
+// Implements the D command --> dumps the profile so far (see Profiler), which is also dumped at T
+void printProfile() {
+    if (!logging(LOG_SUMMARY)) return;
+    if (!profiling()) {
+        LogLine(LOG_SUMMARY) << (PROFILE_BUILD ? "Profiling is off (run with --profile to turn it on). \n"
+                                               : "This build has no profiler (build with -DSIM_PROFILE=1, then run with --profile). \n");
+        return;
+    }
+    // add up the per-core opcode counters
+    CoreProfile total;
+    for (size_t core = 0; core < profiler.cores.size(); core++) {
+        for (int op = 0; op < OP_COUNT; op++) {
+            total.executed[op] += profiler.cores[core].executed[op];
+            total.sampled[op] += profiler.cores[core].sampled[op];
+            total.cycles[op] += profiler.cores[core].cycles[op];
+        }
+    }
+    static const char opNames[OP_COUNT] = {'S', 'A', 'D', 'B', 'E', 'F', 'R'};
+    static const char *const sectionNames[PROFILE_SECTIONS] = {"quantum", "  step cores", "dispatch", "preempt", "steal work", "load program (R)", "log output"};
+    static const char *const switchNames[SWITCH_KINDS] = {"dispatches", "preemptions", "blocks", "forks", "ends"};
+    LogLine report(LOG_SUMMARY);
+    report << "*************************************************************\n";
+    report << "Profile at time " << timestamp << " (cycles are rdtsc ticks, sampled 1 in " << PROFILE_SAMPLE_RATE << ")\n";
+    report.format("%-18s %-12s %-10s %s\n", "opcode", "executed", "sampled", "cycles/op");
+    for (int op = 0; op < OP_COUNT; op++) {
+        report.format("%-18c %-12lu %-10lu %.1f\n", opNames[op], total.executed[op], total.sampled[op],
+                      total.sampled[op] > 0 ? static_cast<double>(total.cycles[op]) / total.sampled[op] : 0.0);
+    }
+    report.format("%-18s %lu\n", "superinstruction", profiler.foldedQuanta);
+    report.format("%-18s %-12s %-10s %-12s %s\n", "section", "calls", "sampled", "cycles/call", "cycles (estimated)");
+    for (int section = 0; section < PROFILE_SECTIONS; section++) {
+        double perCall = profiler.sampled[section] > 0 ? static_cast<double>(profiler.cycles[section]) / profiler.sampled[section] : 0.0;
+        report.format("%-18s %-12lu %-10lu %-12.1f %.0f\n", sectionNames[section], profiler.calls[section], profiler.sampled[section], perCall, perCall * profiler.calls[section]);
+    }
+    report << "Context switches:";
+    for (int kind = 0; kind < SWITCH_KINDS; kind++) {
+        report << (kind > 0 ? ", " : " ") << switchNames[kind] << " " << profiler.switches[kind];
+    }
+    report << "\n";
+    if (profiler.hardware) {
+        uint64_t values[HardwareCounters::COUNTERS];
+        if (profiler.counters.active() && profiler.counters.read(values)) {
+            for (int i = 0; i < HardwareCounters::COUNTERS; i++) values[i] -= profiler.startValues[i];
+            report.format("Hardware counters: %llu cycles, %llu instructions (IPC %.2f), %llu cache misses, %llu branch misses\n",
+                          static_cast<unsigned long long>(values[HardwareCounters::CYCLES]), static_cast<unsigned long long>(values[HardwareCounters::INSTRUCTIONS]),
+                          values[HardwareCounters::CYCLES] > 0 ? static_cast<double>(values[HardwareCounters::INSTRUCTIONS]) / values[HardwareCounters::CYCLES] : 0.0,
+                          static_cast<unsigned long long>(values[HardwareCounters::CACHE_MISSES]), static_cast<unsigned long long>(values[HardwareCounters::BRANCH_MISSES]));
+        } else {
+            report << "Hardware counters: unavailable (" << (profiler.counters.error.empty() ? string("could not read them") : profiler.counters.error) << ")\n";
+        }
+    }
+    report << "*************************************************************\n";
+}
+
+// prints each core's utilization (the share of quanta it spent running a process) and how many processes migrated onto it
+void reportCores() {
+    if (!logging(LOG_SUMMARY)) return;
+    for (size_t core = 0; core < cores.size(); core++) {
+        double utilization = timestamp > 0 ? 100.0 * cores[core].busyQuanta / timestamp : 0;
+        LogLine(LOG_SUMMARY) << "Core " << core << " utilization: " << utilization << "% (" << cores[core].busyQuanta << " of " << timestamp << " quanta), migrations: " << cores[core].migrations << "\n";
+    }
+}
+
+/*
+CommandTransport class definition --> how the bytes typed at the commander's prompt reach the process manager
+    - open() is called once, before main() forks, so both processes share the same channel
+    - after the fork, the commander calls attachSender() and then only ever calls send() and closeSender()
+    - likewise the process manager calls attachReceiver() and then only ever calls receive() and closeReceiver()
+*/
+class CommandTransport {
+    public:
+        virtual ~CommandTransport() {}
+        virtual bool open() = 0;
+        // sends all count bytes, returning false if the process manager has gone away
+        virtual bool send(const char *bytes, size_t count) = 0;
+        // waits for at least one byte and returns how many were copied into bytes, or 0 once the commander has closed its end
+        virtual ssize_t receive(char *bytes, size_t capacity) = 0;
+        // lets go of the end of the channel this process won't use
+        virtual void attachSender() = 0;
+        virtual void attachReceiver() = 0;
+        // tells the other side we are done
+        virtual void closeSender() = 0;
+        virtual void closeReceiver() = 0;
+};
+
+/*
+PipeTransport class definition --> the original transport: a pipe() shared by the commander and the process manager
+*/
+class PipeTransport : public CommandTransport {
+    public:
+        PipeTransport() {
+            pipeDescriptors[0] = -1;
+            pipeDescriptors[1] = -1;
+        }
+
+        bool open() {
+            return pipe(pipeDescriptors) == 0;
+        }
+
+        bool send(const char *bytes, size_t count) {
+            while (count > 0) {
+                ssize_t written = write(pipeDescriptors[1], bytes, count);
+                if (written <= 0) return false;
+                bytes += written;
+                count -= static_cast<size_t>(written);
+            }
+            return true;
+        }
+
+        ssize_t receive(char *bytes, size_t capacity) {
+            ssize_t bytesRead = read(pipeDescriptors[0], bytes, capacity);
+            return bytesRead < 0 ? 0 : bytesRead;
+        }
+
+        // the commander closes the read end (it only writes) and vice versa
+        void attachSender() {
+            close(pipeDescriptors[0]);
+        }
+
+        void attachReceiver() {
+            close(pipeDescriptors[1]);
+        }
+
+        void closeSender() {
+            close(pipeDescriptors[1]);
+        }
+
+        void closeReceiver() {
+            close(pipeDescriptors[0]);
+        }
+
+    private:
+        int pipeDescriptors[2];
+};
+
+/*
+RingTransport class definition --> a single-producer/single-consumer lock-free ring buffer living in shared memory
+    - the ring is mapped with mmap(MAP_SHARED) before main() forks, so the commander (the producer) and the process manager (the consumer) see the same bytes
+    - head counts every byte ever written and tail every byte ever read; only the producer moves head and only the consumer moves tail, so no locks are needed
+    - when the ring is empty (or full) the waiting side sleeps on a futex, and the other side only makes a wake-up syscall if someone is actually asleep
+*/
+class RingTransport : public CommandTransport {
+    public:
+        static const uint32_t RING_SIZE = 1 << 16; // must be a power of two
+
+        RingTransport() : ring(NULL) {}
+
+        ~RingTransport() {
+            if (ring != NULL) munmap(ring, sizeof(SharedRing));
+        }
+
+        bool open() {
+            void *memory = mmap(NULL, sizeof(SharedRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return false;
+            ring = new (memory) SharedRing();
+            return true;
+        }
+
+        bool send(const char *bytes, size_t count) {
+            while (count > 0) {
+                uint32_t head = ring->head.load(memory_order_relaxed);
+                uint32_t tail = ring->tail.load(memory_order_acquire);
+                uint32_t space = RING_SIZE - (head - tail);
+                if (space == 0) {
+                    if (ring->receiverClosed.load(memory_order_acquire)) return false;
+                    // the ring is full --> sleep until the consumer frees some space
+                    waitFor(ring->tail, tail, ring->senderSignal, ring->senderWaiting, ring->receiverClosed);
+                    continue;
+                }
+                uint32_t chunk = count < space ? static_cast<uint32_t>(count) : space;
+                copyIn(head, bytes, chunk);
+                ring->head.store(head + chunk, memory_order_release);
+                wake(ring->receiverSignal, ring->receiverWaiting);
+                bytes += chunk;
+                count -= chunk;
+            }
+            return true;
+        }
+
+        ssize_t receive(char *bytes, size_t capacity) {
+            while (true) {
+                uint32_t tail = ring->tail.load(memory_order_relaxed);
+                uint32_t head = ring->head.load(memory_order_acquire);
+                if (head != tail) {
+                    uint32_t available = head - tail;
+                    uint32_t chunk = capacity < available ? static_cast<uint32_t>(capacity) : available;
+                    copyOut(tail, bytes, chunk);
+                    ring->tail.store(tail + chunk, memory_order_release);
+                    wake(ring->senderSignal, ring->senderWaiting);
+                    return chunk;
+                }
+                if (ring->senderClosed.load(memory_order_acquire)) return 0;
+                // the ring is empty --> sleep until the producer writes something
+                waitFor(ring->head, head, ring->receiverSignal, ring->receiverWaiting, ring->senderClosed);
+            }
+        }
+
+        // both processes map the whole ring, so there is nothing to let go of
+        void attachSender() {}
+
+        void attachReceiver() {}
+
+        void closeSender() {
+            ring->senderClosed.store(1);
+            wake(ring->receiverSignal, ring->receiverWaiting);
+        }
+
+        void closeReceiver() {
+            ring->receiverClosed.store(1);
+            wake(ring->senderSignal, ring->senderWaiting);
+        }
+
+    private:
+        // the part of the transport that lives in shared memory (each index gets its own cache line)
+        struct SharedRing {
+            alignas(64) atomic<uint32_t> head;
+            atomic<uint32_t> receiverSignal;
+            atomic<uint32_t> receiverWaiting;
+            atomic<uint32_t> senderClosed;
+            alignas(64) atomic<uint32_t> tail;
+            atomic<uint32_t> senderSignal;
+            atomic<uint32_t> senderWaiting;
+            atomic<uint32_t> receiverClosed;
+            alignas(64) char data[RING_SIZE];
+
+            SharedRing() : head(0), receiverSignal(0), receiverWaiting(0), senderClosed(0),
+                           tail(0), senderSignal(0), senderWaiting(0), receiverClosed(0) {}
+        };
+
+        SharedRing *ring;
+
+        void copyIn(uint32_t position, const char *bytes, uint32_t count) {
+            uint32_t offset = position & (RING_SIZE - 1);
+            uint32_t first = count < RING_SIZE - offset ? count : RING_SIZE - offset;
+            memcpy(ring->data + offset, bytes, first);
+            memcpy(ring->data, bytes + first, count - first);
+        }
+
+        void copyOut(uint32_t position, char *bytes, uint32_t count) {
+            uint32_t offset = position & (RING_SIZE - 1);
+            uint32_t first = count < RING_SIZE - offset ? count : RING_SIZE - offset;
+            memcpy(bytes, ring->data + offset, first);
+            memcpy(bytes + first, ring->data, count - first);
+        }
+};
+
+/*
+Command class definition --> one command for the process manager, as typed at the commander's prompt
+    1. operation --> the command letter, exactly as it was typed (Q, U, P, T, ...)
+    2. argKind --> what kind of argument followed the letter
+        - 0 if there was no argument
+        - '#' for a count (ex: "Q 500" runs 500 quanta) or a process ID (ex: "U 7" unblocks process 7)
+        - '*' for "until idle" (ex: "Q *")
+        - '@' for "until a timestamp" (ex: "Q @1200")
+        - '"' for a filename (ex: "C run.snap" writes a checkpoint to run.snap)
+    3. intArg --> the number that came with a '#' or '@' argument
+    4. stringArg --> the filename that came with a '"' argument (the rest of the line)
+- Commands without an argument can still be run together on one line, so "QQP" is three commands
+- The grammar is the same at the prompt and in a script (--script <file>)
+    script   --> any mix of blanks, newlines, comments and commands
+    comment  --> '#' up to the end of the line
+    command  --> Q [<count> | * | @<timestamp>]  |  U [<pid>]  |  C <filename>  |  L <filename>  |  P  |  M  |  D  |  T
+        - letters are case-insensitive, and blanks (but not newlines) may separate a letter from its argument
+        - a filename runs to the end of the line (trailing blanks dropped), so it must be the last thing on its line
+        - any other character is an invalid command, reported and skipped
+*/
+class Command {
+    public:
+        char operation;
+        char argKind;
+        unsigned long intArg;
+        string stringArg;
+};
+
+/*
+CommandSource class definition --> where the process manager gets its commands from
+    - next() reads the next command into command, returning false once there are no more
+*/
+class CommandSource {
+    public:
+        virtual ~CommandSource() {}
+        virtual bool next(Command &command) = 0;
+};
+
+/*
+CommandReader class definition --> reads Commands out of a CommandTransport (ex: our pipe), a file descriptor, or memory (a string or a mapped script)
+    - it receives in large chunks, so a batch of commands costs one read() rather than one read() per character
+    - the commander sends a whole line at a time, so whatever follows a command letter on the same line is already in the pipe when we look for its argument
+*/
+class CommandReader : public CommandSource {
+    public:
+        CommandReader(CommandTransport &commandTransport) : transport(&commandTransport), descriptor(-1), data(buffer), pos(0), len(0) {}
+        CommandReader(int fd) : transport(NULL), descriptor(fd), data(buffer), pos(0), len(0) {}
+        CommandReader(const char *text, size_t size) : transport(NULL), descriptor(-1), data(text), pos(0), len(size) {}
+        CommandReader(const string &text) : transport(NULL), descriptor(-1), data(text.data()), pos(0), len(text.size()) {}
+
+        // reads the next command into command, returning false once the input is exhausted (or the pipe is broken)
+        bool next(Command &command) {
+            int ch;
+            while (true) {
+                do {
+                    ch = get();
+                } while (ch != -1 && isspace(ch));
+                if (ch != '#') break;
+                // a comment runs to the end of the line
+                while (peek() != -1 && peek() != '\n') get();
+            }
+            if (ch == -1) return false;
+
+            command.operation = static_cast<char>(ch);
+            command.argKind = 0;
+            command.intArg = 0;
+            command.stringArg.clear();
+            if (toupper(ch) == 'Q') {
+                // skip blanks (but not the end of the line) to find Q's argument, if it has one
+                while (peek() == ' ' || peek() == '\t') get();
+                ch = peek();
+                if (isdigit(ch)) {
+                    command.argKind = '#';
+                    command.intArg = readNumber();
+                } else if (ch == '*') {
+                    get();
+                    command.argKind = '*';
+                } else if (ch == '@') {
+                    get();
+                    while (peek() == ' ' || peek() == '\t') get();
+                    command.argKind = '@';
+                    command.intArg = readNumber();
+                }
+            } else if (toupper(ch) == 'U') {
+                // U may name the process to unblock
+                while (peek() == ' ' || peek() == '\t') get();
+                if (isdigit(peek())) {
+                    command.argKind = '#';
+                    command.intArg = readNumber();
+                }
+            } else if (toupper(ch) == 'C' || toupper(ch) == 'L') {
+                // C and L take a filename --> everything up to the end of the line
+                while (peek() == ' ' || peek() == '\t') get();
+                while (peek() != -1 && peek() != '\n') command.stringArg += static_cast<char>(get());
+                while (!command.stringArg.empty() && isspace(static_cast<unsigned char>(command.stringArg[command.stringArg.size() - 1]))) {
+                    command.stringArg.erase(command.stringArg.size() - 1);
+                }
+                if (!command.stringArg.empty()) command.argKind = '"';
+            }
+            return true;
+        }
+
+    private:
+        CommandTransport *transport;
+        int descriptor;
+        char buffer[65536];
+        const char *data;
+        size_t pos;
+        size_t len;
+
+        // returns the next character without consuming it, or -1 at the end of the input
+        int peek() {
+            if (pos == len) {
+                ssize_t bytesRead;
+                if (transport != NULL) {
+                    bytesRead = transport->receive(buffer, sizeof(buffer));
+                } else if (descriptor != -1) {
+                    do {
+                        bytesRead = read(descriptor, buffer, sizeof(buffer));
+                    } while (bytesRead < 0 && errno == EINTR);
+                } else {
+                    return -1;
+                }
+                if (bytesRead <= 0) return -1;
+                pos = 0;
+                len = static_cast<size_t>(bytesRead);
+            }
+            return static_cast<unsigned char>(data[pos]);
+        }
+
+        // returns and consumes the next character, or -1 at the end of the input
+        int get() {
+            int ch = peek();
+            if (ch != -1) pos++;
+            return ch;
+        }
+
+        unsigned long readNumber() {
+            unsigned long number = 0;
+            while (isdigit(peek())) {
+                number = number * 10 + (get() - '0');
+            }
+            return number;
+        }
+};
+
+/*
+ScriptSource class definition --> reads Commands out of a script file, for runs with no one at the prompt (--script <file>)
+    - a regular file is mmap()ed and parsed in place, so the whole script is handed over as one batch --> no read() per command, let alone per character
+    - anything else (a pipe, or "-" for stdin) is read() in CommandReader's 64KB chunks
+*/
+class ScriptSource : public CommandSource {
+    public:
+        ScriptSource() : fd(-1), mapping(NULL), mappingSize(0), reader(NULL) {}
+
+        ~ScriptSource() {
+            close();
+        }
+
+        // opens the script at path ("-" for stdin), returning false (with errno set) if it can't be read
+        bool open(const string &path) {
+            close();
+            fd = path == "-" ? dup(STDIN_FILENO) : ::open(path.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd == -1 || fstat(fd, &info) == -1) return false;
+            if (S_ISREG(info.st_mode)) {
+                mappingSize = static_cast<size_t>(info.st_size);
+                if (mappingSize == 0) {
+                    reader = new CommandReader("", 0);
+                    return true;
+                }
+                void *memory = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+                if (memory != MAP_FAILED) {
+                    madvise(memory, mappingSize, MADV_SEQUENTIAL);
+                    mapping = memory;
+                    reader = new CommandReader(static_cast<const char *>(mapping), mappingSize);
+                    return true;
+                }
+                mappingSize = 0;
+            }
+            reader = new CommandReader(fd);
+            return true;
+        }
+
+        void close() {
+            delete reader;
+            reader = NULL;
+            if (mapping != NULL) munmap(mapping, mappingSize);
+            mapping = NULL;
+            mappingSize = 0;
+            if (fd != -1) ::close(fd);
+            fd = -1;
+        }
+
+        bool next(Command &command) {
+            return reader != NULL && reader->next(command);
+        }
+
+    private:
+        int fd;
+        void *mapping;
+        size_t mappingSize;
+        CommandReader *reader;
+};
+
+/*
+Trace files --> a TraceHeader, then one TraceEvent per command or transition
+    - the header remembers the options the run used, since replaying with any other policy or core count would give different transitions
+        - that includes --retain-finished (which decides when PCB slots are reused), and the fast paths the run took (--superinstructions, --lockstep)
+    - version 2 traces come from simulators where B can take a tick count and F honors its offset, so a version 1 trace can't be replayed faithfully
+*/
+const char TRACE_MAGIC[8] = {'S', 'K', 'E', 'L', 'T', 'R', 'C', 'E'};
+const uint32_t TRACE_VERSION = 2;
+
+enum TraceFlag {
+    TRACE_SUPERINSTRUCTIONS = 1, // --superinstructions=on
+    TRACE_LOCKSTEP = 2,          // --lockstep=on
+    TRACE_FORK_OFFSETS = 4       // F <n> starts the child n instructions on (always set by this version)
+};
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cores;
+    char policy[16];
+    uint32_t timeSlice;
+    uint32_t agingInterval;
+    uint32_t levels;
+    uint32_t boostInterval;
+    uint32_t flags;         // TraceFlags
+    int32_t retainFinished; // --retain-finished
+};
+
+/*
+TraceWriter class definition --> records a trace to a file
+    - events are buffered and written out BUFFER_EVENTS at a time, so recording costs one write() per few thousand events
+*/
+class TraceWriter : public TraceRecorder {
+    public:
+        static const size_t BUFFER_EVENTS = 4096;
+
+        TraceWriter() : fd(-1) {}
+
+        ~TraceWriter() {
+            close();
+        }
+
+        // creates filename and writes the header, describing the options the simulation is about to run with
+        bool open(const string &filename) {
+            fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) return false;
+            TraceHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+            header.version = TRACE_VERSION;
+            header.cores = coreCount;
+            strncpy(header.policy, policyOptions.name.c_str(), sizeof(header.policy) - 1);
+            header.timeSlice = policyOptions.timeSlice;
+            header.agingInterval = policyOptions.agingInterval;
+            header.levels = policyOptions.levels;
+            header.boostInterval = policyOptions.boostInterval;
+            header.flags = TRACE_FORK_OFFSETS | (useSuperinstructions ? TRACE_SUPERINSTRUCTIONS : 0) | (useLockstep ? TRACE_LOCKSTEP : 0);
+            header.retainFinished = retainFinished;
+            buffer.reserve(BUFFER_EVENTS);
+            return writeAll(&header, sizeof(header));
+        }
+
+        void command(const Command &command) {
+            TraceEvent event;
+            memset(&event, 0, sizeof(event));
+            event.kind = TRACE_COMMAND;
+            event.operation = static_cast<uint8_t>(command.operation);
+            event.argKind = static_cast<uint8_t>(command.argKind);
+            event.timestamp = timestamp;
+            event.core = -1;
+            event.process = -1;
+            event.arg = static_cast<int64_t>(command.intArg);
+            append(event);
+        }
+
+        void transition(const TraceEvent &event) {
+            append(event);
+        }
+
+        // writes out whatever is still buffered and closes the file
+        bool close() {
+            if (fd == -1) return true;
+            bool written = flush();
+            ::close(fd);
+            fd = -1;
+            return written;
+        }
+
+    private:
+        int fd;
+        vector<TraceEvent> buffer;
+
+        void append(const TraceEvent &event) {
+            buffer.push_back(event);
+            if (buffer.size() == BUFFER_EVENTS) flush();
+        }
+
+        bool flush() {
+            bool written = writeAll(buffer.data(), buffer.size() * sizeof(TraceEvent));
+            buffer.clear();
+            return written;
+        }
+
+        bool writeAll(const void *data, size_t count) {
+            const char *bytes = static_cast<const char *>(data);
+            while (count > 0) {
+                ssize_t written = write(fd, bytes, count);
+                if (written <= 0) return false;
+                bytes += written;
+                count -= static_cast<size_t>(written);
+            }
+            return true;
+        }
+};
+
+// the names of the TraceEventKinds, for describeTraceEvent()
+const char *const TRACE_EVENT_NAMES[] = {"command", "schedule", "preempt", "block", "unblock", "fork", "replace", "end"};
+
+// returns a readable description of event (ex: "t=12 core 0 fork process 3 (arg 4)")
+string describeTraceEvent(const TraceEvent &event) {
+    stringstream description;
+    description << "t=" << event.timestamp << " ";
+    if (event.kind == TRACE_COMMAND) {
+        description << "command " << static_cast<char>(event.operation);
+        if (event.argKind == '#') description << " " << event.arg;
+        if (event.argKind == '*') description << " *";
+        if (event.argKind == '@') description << " @" << event.arg;
+    } else if (event.kind <= TRACE_END) {
+        description << "core " << event.core << " " << TRACE_EVENT_NAMES[event.kind] << " process " << event.process << " (arg " << event.arg << ")";
+    } else {
+        description << "unknown event " << static_cast<int>(event.kind);
+    }
+    return description.str();
+}
+
+/*
+TraceReplayer class definition --> replays a trace: it is both the process manager's command source and the recorder that checks its transitions
+    - the trace is mmap()ed, and a single cursor walks it --> next() hands out the commands, and transition() expects the transitions in between them in the same order
+    - a transition that doesn't match (or one that the replay skipped, or added) counts as a mismatch; the first one is kept for the report
+*/
+class TraceReplayer : public TraceRecorder, public CommandSource {
+    public:
+        unsigned long mismatches;
+        size_t firstMismatch;     // index of the first mismatched event
+        string expectedEvent;     // ... what the trace had there
+        string actualEvent;       // ... and what the replay did instead
+
+        TraceReplayer() : mismatches(0), firstMismatch(0), mapping(NULL), mappingSize(0), events(NULL), count(0), position(0), commands(0) {}
+
+        ~TraceReplayer() {
+            if (mapping != NULL) munmap(mapping, mappingSize);
+        }
+
+        // maps filename and switches policyOptions, coreCount and the other options in the header to the ones it was recorded with
+        bool open(const string &filename) {
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            struct stat info;
+            if (fd == -1 || fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(TraceHeader)) {
+                if (fd != -1) close(fd);
+                cout << "Error opening trace " << filename << endl;
+                return false;
+            }
+            mappingSize = static_cast<size_t>(info.st_size);
+            mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            close(fd);
+            if (mapping == MAP_FAILED) {
+                mapping = NULL;
+                cout << "Error opening trace " << filename << endl;
+                return false;
+            }
+            TraceHeader header;
+            memcpy(&header, mapping, sizeof(header));
+            if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION || header.cores == 0
+                || (header.flags & TRACE_FORK_OFFSETS) == 0 || header.retainFinished < 0) {
+                cout << filename << " - Not a trace, or a trace from another version" << endl;
+                return false;
+            }
+            madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+            header.policy[sizeof(header.policy) - 1] = '\0';
+            policyOptions.name = header.policy;
+            policyOptions.timeSlice = header.timeSlice;
+            policyOptions.agingInterval = header.agingInterval;
+            policyOptions.levels = header.levels;
+            policyOptions.boostInterval = header.boostInterval;
+            coreCount = header.cores;
+            useSuperinstructions = (header.flags & TRACE_SUPERINSTRUCTIONS) != 0;
+            useLockstep = (header.flags & TRACE_LOCKSTEP) != 0;
+            retainFinished = header.retainFinished;
+            events = reinterpret_cast<const TraceEvent *>(static_cast<const char *>(mapping) + sizeof(header));
+            count = (mappingSize - sizeof(header)) / sizeof(TraceEvent);
+            position = 0;
+            return true;
+        }
+
+        // the next recorded command (any transitions before it that the replay didn't do are mismatches)
+        bool next(Command &command) {
+            while (position < count && events[position].kind != TRACE_COMMAND) {
+                mismatch(position, describeTraceEvent(events[position]), "nothing");
+                position++;
+            }
+            if (position == count) return false;
+            const TraceEvent &event = events[position++];
+            command.operation = static_cast<char>(event.operation);
+            command.argKind = static_cast<char>(event.argKind);
+            command.intArg = static_cast<unsigned long>(event.arg);
+            commands++;
+            return true;
+        }
+
+        // the commands come from the trace itself, so there is nothing to check
+        void command(const Command &command) {}
+
+        void transition(const TraceEvent &event) {
+            if (position < count && events[position].kind != TRACE_COMMAND) {
+                if (memcmp(&events[position], &event, sizeof(event)) != 0) {
+                    mismatch(position, describeTraceEvent(events[position]), describeTraceEvent(event));
+                }
+                position++;
+            } else {
+                mismatch(position, position < count ? describeTraceEvent(events[position]) : "the end of the trace", describeTraceEvent(event));
+            }
+        }
+
+        // counts whatever the replay didn't get to (call once the process manager is done)
+        void finish() {
+            for (; position < count; position++) {
+                mismatch(position, describeTraceEvent(events[position]), "nothing");
+            }
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        unsigned long commandCount() const {
+            return commands;
+        }
+
+    private:
+        void *mapping;
+        size_t mappingSize;
+        const TraceEvent *events;
+        size_t count;
+        size_t position;
+        unsigned long commands;
+
+        void mismatch(size_t index, const string &expected, const string &actual) {
+            if (mismatches++ == 0) {
+                firstMismatch = index;
+                expectedEvent = expected;
+                actualEvent = actual;
+            }
+        }
+};
+
+/*
+Snapshots --> a checkpoint of the whole simulation, written by the "C <snapshot>" command and read back by "L <snapshot>" (or "--restore=<snapshot>")
+    - layout (native byte order, with every array 8-byte aligned --> see SnapshotWriter):
+        1. a SnapshotHeader --> the options the run was started with, and the timestamp
+        2. the programs --> each distinct program once, matched up by a hash of its content (so a million processes running init store it once)
+        3. the PCB table, one array per field (a process' program is stored as its index in 2.), free slots and all, then the number of processes created so far
+        4. every core --> what it is running, its statistics and its ready queue
+        5. the timers, and the scheduling metrics
+    - that is everything the process manager keeps between two commands, so a restored run carries on exactly as the original one would have
+    - restoring maps the file and copies each array out of the mapping in one go, so even a million processes load in milliseconds
+    - checkpoint and restore commands aren't recorded in traces (a trace can't hold a filename) --> so L is refused while recording, and C (which changes nothing) is left out
+*/
+const char SNAPSHOT_MAGIC[8] = {'S', 'K', 'E', 'L', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cores;
+    char policy[16];
+    uint32_t timeSlice;
+    uint32_t agingInterval;
+    uint32_t levels;
+    uint32_t boostInterval;
+    uint32_t timestamp;
+    uint32_t padding;
+};
+
+// a hash (FNV-1a) of a program's instructions and filenames
+uint64_t hashProgram(const Program &program) {
+    uint64_t hash = 14695981039346656037ULL;
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(program.code());
+    for (size_t i = 0; i < program.size() * sizeof(Op); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    for (size_t i = 0; i < program.strings.size(); i++) {
+        for (size_t j = 0; j <= program.strings[i].size(); j++) {
+            hash = (hash ^ static_cast<unsigned char>(program.strings[i].c_str()[j])) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+// returns true if a and b hold the same instructions and filenames
+bool sameProgram(const Program &a, const Program &b) {
+    return a.size() == b.size() && a.strings == b.strings && memcmp(a.code(), b.code(), a.size() * sizeof(Op)) == 0;
+}
+
+/*
+SnapshotPrograms class definition --> numbers the distinct programs going into a snapshot
+    - indexOf() gives the same index to every handle of a program, and to every program with the same content (found by hashProgram())
+*/
+class SnapshotPrograms {
+    public:
+        vector<const Program *> programs;
+
+        SnapshotPrograms() : lastProgram(NULL), lastIndex(-1) {}
+
+        // the index program is stored at (-1 for a process without a program)
+        int32_t indexOf(const ProgramHandle &program) {
+            if (!program) return -1;
+            // processes next to each other in the table usually run the same program
+            if (program.get() == lastProgram) return lastIndex;
+            int32_t index;
+            unordered_map<const Program *, int32_t>::iterator known = seen.find(program.get());
+            if (known != seen.end()) {
+                index = known->second;
+            } else {
+                vector<int32_t> &sameHash = byHash[hashProgram(*program)];
+                index = -1;
+                for (size_t i = 0; i < sameHash.size() && index == -1; i++) {
+                    if (sameProgram(*programs[sameHash[i]], *program)) index = sameHash[i];
+                }
+                if (index == -1) {
+                    index = static_cast<int32_t>(programs.size());
+                    programs.push_back(program.get());
+                    sameHash.push_back(index);
+                }
+                seen[program.get()] = index;
+            }
+            lastProgram = program.get();
+            lastIndex = index;
+            return index;
+        }
+
+    private:
+        unordered_map<const Program *, int32_t> seen;
+        unordered_map<uint64_t, vector<int32_t> > byHash;
+        const Program *lastProgram;
+        int32_t lastIndex;
+};
+
+// Implements the C <snapshot> command --> writes the whole simulation to filename
+bool writeSnapshot(const string &filename) {
+    SnapshotWriter out;
+    // 1. the header
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.cores = static_cast<uint32_t>(cores.size());
+    strncpy(header.policy, policyOptions.name.c_str(), sizeof(header.policy) - 1);
+    header.timeSlice = policyOptions.timeSlice;
+    header.agingInterval = policyOptions.agingInterval;
+    header.levels = policyOptions.levels;
+    header.boostInterval = policyOptions.boostInterval;
+    header.timestamp = timestamp;
+    out.put(header);
+
+    // 2. the programs, each once
+    SnapshotPrograms table;
+    vector<int32_t> processPrograms(pcbTable.size());
+    for (int i = 0; i < pcbTable.size(); i++) {
+        processPrograms[i] = table.indexOf(pcbTable.program[i]);
+    }
+    vector<int32_t> corePrograms(cores.size());
+    for (size_t core = 0; core < cores.size(); core++) {
+        corePrograms[core] = table.indexOf(cores[core].program);
+    }
+    out.put<uint64_t>(table.programs.size());
+    for (size_t i = 0; i < table.programs.size(); i++) {
+        const Program &program = *table.programs[i];
+        out.putString(program.source);
+        out.putArray(program.code(), program.size());
+        out.put<uint64_t>(program.strings.size());
+        for (size_t j = 0; j < program.strings.size(); j++) {
+            out.putString(program.strings[j]);
+        }
+    }
+
+    // 3. the PCB table
+    out.putVector(pcbTable.hot);
+    out.putVector(pcbTable.processId);
+    out.putVector(pcbTable.parentProcessId);
+    out.putVector(pcbTable.startTime);
+    out.putVector(pcbTable.finishTime);
+    out.putVector(pcbTable.priority);
+    out.putVector(processPrograms);
+    out.putVector(pcbTable.lastCore);
+    out.putVector(pcbTable.stateSince);
+    out.putVector(pcbTable.waitingTime);
+    out.putVector(pcbTable.hasRun);
+    out.putVector(pcbTable.wakeTime);
+    out.putVector(pcbTable.stateNext);
+    out.putVector(pcbTable.statePrev);
+    for (int state = 0; state <= STATE_FINISHED; state++) {
+        out.put(pcbTable.lists[state]);
+    }
+    out.put<uint64_t>(pcbTable.created);
+
+    // 4. the cores
+    for (size_t core = 0; core < cores.size(); core++) {
+        const Cpu &saved = cores[core];
+        out.put(corePrograms[core]);
+        out.put<int32_t>(saved.programCounter);
+        out.put<int32_t>(saved.value);
+        out.put<uint32_t>(saved.sliceUsed);
+        out.put<int32_t>(saved.runningProcessID);
+        out.put<uint64_t>(saved.busyQuanta);
+        out.put<uint64_t>(saved.migrations);
+        saved.runQueue->save(out);
+    }
+
+    // 5. the timers and the metrics (SchedulerMetrics is nothing but counters, so it is written as it is)
+    timers.save(out);
+    out.put<uint64_t>(armedTimers);
+    out.put(metrics);
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Error creating snapshot " << filename << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    size_t written = 0;
+    while (written < out.bytes.size()) {
+        ssize_t count = write(fd, out.bytes.data() + written, out.bytes.size() - written);
+        if (count == -1 && errno == EINTR) continue;
+        if (count <= 0) break;
+        written += static_cast<size_t>(count);
+    }
+    close(fd);
+    if (written < out.bytes.size()) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Error writing snapshot " << filename << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// returns true if every entry of links is a PCB slot (or -1)
+bool validLinks(const vector<int> &links, int processes) {
+    for (size_t i = 0; i < links.size(); i++) {
+        if (links[i] < -1 || links[i] >= processes) return false;
+    }
+    return true;
+}
+
+/*
+consistentSnapshot() checks that the parts of a restored snapshot agree with each other, so a damaged one can't index past a table later on
+    1. every state list runs from its head to its tail through count processes of that state, with statePrev pointing back along the way, and every process is on one
+        - a list that comes back to a process it already visited fails the check, so a damaged link can't send reporterProcess() or allocate() round in a loop later on
+    2. a running core runs a running process with a program, and its programCounter is within that program (at its end, the process ends)
+    3. every ready queue entry is a ready process, no process is queued twice, and together the queues hold every ready process
+    4. every timer is for a PCB slot, every process waiting on a timer is blocked and has a timer for its wakeTime, and armedTimers counts them
+    5. every process last ran on one of the cores (or hasn't run yet)
+*/
+bool consistentSnapshot(const PcbTable &table, const vector<Cpu> &restoredCores, const TimerWheel &restoredTimers, uint64_t restoredArmedTimers) {
+    int processes = table.size();
+    vector<char> listed(processes, 0);
+    int total = 0;
+    for (int state = 0; state <= STATE_FINISHED; state++) {
+        const StateList &list = table.lists[state];
+        int previous = -1;
+        int steps = 0;
+        for (int process = list.head; process != -1; process = table.stateNext[process]) {
+            if (listed[process] || table.hot[process].state != state || table.statePrev[process] != previous) return false;
+            listed[process] = 1;
+            previous = process;
+            steps++;
+        }
+        if (previous != list.tail || steps != list.count) return false;
+        total += steps;
+    }
+    if (total != processes) return false;
+
+    vector<char> seen(processes, 0);
+    vector<int> ready;
+    for (size_t core = 0; core < restoredCores.size(); core++) {
+        const Cpu &restored = restoredCores[core];
+        int process = restored.runningProcessID;
+        if (process != -1) {
+            if (restored.pProgram == NULL || table.hot[process].state != STATE_RUNNING || seen[process]) return false;
+            if (restored.programCounter < 0 || static_cast<size_t>(restored.programCounter) > restored.pProgram->size()) return false;
+            seen[process] = 1;
+        }
+        restored.runQueue->appendReady(ready);
+    }
+    if (ready.size() != static_cast<size_t>(table.lists[STATE_READY].count)) return false;
+    for (size_t i = 0; i < ready.size(); i++) {
+        int process = ready[i];
+        if (process < 0 || process >= processes || table.hot[process].state != STATE_READY || seen[process]) return false;
+        seen[process] = 1;
+    }
+
+    vector<Timer> pending;
+    restoredTimers.appendTimers(pending);
+    vector<char> hasTimer(processes, 0);
+    for (size_t i = 0; i < pending.size(); i++) {
+        int process = pending[i].process;
+        if (process < 0 || process >= processes) return false;
+        if (table.wakeTime[process] != 0 && table.wakeTime[process] == pending[i].deadline) hasTimer[process] = 1;
+    }
+    uint64_t armed = 0;
+    for (int process = 0; process < processes; process++) {
+        if (table.wakeTime[process] == 0) continue;
+        if (table.hot[process].state != STATE_BLOCKED || !hasTimer[process]) return false;
+        armed++;
+    }
+    if (armed != restoredArmedTimers) return false;
+
+    for (int process = 0; process < processes; process++) {
+        if (table.lastCore[process] < -1 || table.lastCore[process] >= static_cast<int>(restoredCores.size())) return false;
+    }
+    return true;
+}
+
+// Implements the L <snapshot> command (and --restore=<snapshot>) --> replaces the whole simulation with the one in filename
+//    - everything is read into new tables and checked first, so the simulation is left alone if the snapshot turns out to be unreadable or inconsistent
+//    - the profile (--profile) keeps counting across it
+bool restoreSnapshot(const string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd == -1 || fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+        if (fd != -1) close(fd);
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Error opening snapshot " << filename << "\n";
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Error opening snapshot " << filename << "\n";
+        return false;
+    }
+    SnapshotReader in(static_cast<const char *>(mapping), size);
+
+    // 1. the header --> the options the snapshot's run was started with
+    SnapshotHeader header;
+    in.get(header);
+    header.policy[sizeof(header.policy) - 1] = '\0';
+    PolicyOptions options;
+    options.name = header.policy;
+    options.timeSlice = header.timeSlice;
+    options.agingInterval = header.agingInterval;
+    options.levels = header.levels;
+    options.boostInterval = header.boostInterval;
+    SchedulingPolicy *probe = createPolicy(options);
+    // (every core takes up more than 32 bytes of the snapshot, so a damaged core count can't make us allocate more than the file could hold)
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 && header.version == SNAPSHOT_VERSION
+        && header.cores > 0 && header.cores <= size / 32 && probe != NULL;
+    delete probe;
+    if (!valid) {
+        munmap(mapping, size);
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << " - Not a snapshot, or a snapshot from another version\n";
+        return false;
+    }
+
+    // 2. the programs
+    uint64_t programCount = 0;
+    in.get(programCount);
+    vector<ProgramHandle> programs;
+    for (uint64_t i = 0; i < programCount && in.ok(); i++) {
+        shared_ptr<Program> program = allocate_shared<Program>(PoolAllocator<Program>());
+        in.getString(program->source);
+        in.getVector(program->ops);
+        uint64_t stringCount = 0;
+        in.get(stringCount);
+        for (uint64_t j = 0; j < stringCount && in.ok(); j++) {
+            program->strings.push_back(string());
+            in.getString(program->strings.back());
+        }
+        for (size_t j = 0; j < program->ops.size(); j++) {
+            const Op &op = program->ops[j];
+            if (op.opcode >= OP_COUNT || (op.opcode == OP_REPLACE && (op.arg < 0 || static_cast<size_t>(op.arg) >= program->strings.size()))) valid = false;
+        }
+        programs.push_back(program);
+    }
+
+    // 3. the PCB table
+    PcbTable table;
+    vector<int32_t> processPrograms;
+    in.getVector(table.hot);
+    in.getVector(table.processId);
+    in.getVector(table.parentProcessId);
+    in.getVector(table.startTime);
+    in.getVector(table.finishTime);
+    in.getVector(table.priority);
+    in.getVector(processPrograms);
+    in.getVector(table.lastCore);
+    in.getVector(table.stateSince);
+    in.getVector(table.waitingTime);
+    in.getVector(table.hasRun);
+    in.getVector(table.wakeTime);
+    in.getVector(table.stateNext);
+    in.getVector(table.statePrev);
+    for (int state = 0; state <= STATE_FINISHED; state++) {
+        in.get(table.lists[state]);
+    }
+    uint64_t created = 0;
+    in.get(created);
+    table.created = static_cast<unsigned long>(created);
+    int processes = table.size();
+    size_t count = table.hot.size();
+    valid = valid && table.processId.size() == count && table.parentProcessId.size() == count && table.startTime.size() == count
+        && table.finishTime.size() == count && table.priority.size() == count && processPrograms.size() == count && table.lastCore.size() == count
+        && table.stateSince.size() == count && table.waitingTime.size() == count && table.hasRun.size() == count && table.wakeTime.size() == count
+        && table.stateNext.size() == count && table.statePrev.size() == count
+        && count <= static_cast<size_t>(PID_SLOTS)
+        && validLinks(table.stateNext, processes) && validLinks(table.statePrev, processes) && validLinks(processPrograms, static_cast<int>(programs.size()));
+    for (int state = 0; state <= STATE_FINISHED; state++) {
+        const StateList &list = table.lists[state];
+        if (list.head < -1 || list.head >= processes || list.tail < -1 || list.tail >= processes) valid = false;
+    }
+    for (size_t i = 0; i < count && valid; i++) {
+        // (read as a plain integer, since a damaged one needn't be a State at all)
+        underlying_type<State>::type state;
+        memcpy(&state, &table.hot[i].state, sizeof(state));
+        if (state < STATE_FREE || state > STATE_FINISHED) valid = false;
+        // a PID has to name its own slot, or find() would never find it
+        if (table.processId[i] < 0 || (table.processId[i] & (PID_SLOTS - 1)) != static_cast<int>(i)) valid = false;
+    }
+    if (valid) {
+        table.program.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            if (processPrograms[i] != -1) table.program[i] = programs[processPrograms[i]];
+        }
+    }
+
+    // 4. the cores
+    vector<Cpu> restoredCores(header.cores);
+    for (size_t core = 0; core < restoredCores.size(); core++) {
+        Cpu &restored = restoredCores[core];
+        int32_t program = -1;
+        uint64_t busyQuanta = 0;
+        uint64_t migrations = 0;
+        in.get(program);
+        in.get(restored.programCounter);
+        in.get(restored.value);
+        in.get(restored.sliceUsed);
+        in.get(restored.runningProcessID);
+        in.get(busyQuanta);
+        in.get(migrations);
+        restored.busyQuanta = static_cast<unsigned long>(busyQuanta);
+        restored.migrations = static_cast<unsigned long>(migrations);
+        restored.runQueue = createPolicy(options);
+        restored.runQueue->restore(in);
+        if (program < -1 || program >= static_cast<int32_t>(programs.size()) || restored.runningProcessID < -1 || restored.runningProcessID >= processes) {
+            valid = false;
+        } else if (program != -1) {
+            restored.program = programs[program];
+            restored.pProgram = restored.program.get();
+        }
+    }
+
+    // 5. the timers and the metrics
+    TimerWheel restoredTimers;
+    uint64_t restoredArmedTimers = 0;
+    SchedulerMetrics restoredMetrics;
+    restoredTimers.restore(in);
+    in.get(restoredArmedTimers);
+    in.get(restoredMetrics);
+    munmap(mapping, size);
+    valid = valid && in.ok() && consistentSnapshot(table, restoredCores, restoredTimers, restoredArmedTimers);
+
+    if (!valid) {
+        for (size_t core = 0; core < restoredCores.size(); core++) {
+            delete restoredCores[core].runQueue;
+        }
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << filename << " - The snapshot is truncated or damaged\n";
+        return false;
+    }
+
+    // the whole snapshot was read, so switch over to it
+    policyOptions = options;
+    coreCount = header.cores;
+    rebuildCores();
+    storeCore();
+    for (size_t core = 0; core < cores.size(); core++) {
+        delete cores[core].runQueue;
+        CoreProfile *profile = cores[core].profile;
+        cores[core] = move(restoredCores[core]);
+        cores[core].profile = profile;
+    }
+    pcbTable = move(table);
+    timers = move(restoredTimers);
+    armedTimers = static_cast<unsigned long>(restoredArmedTimers);
+    metrics = restoredMetrics;
+    timestamp = header.timestamp;
+    loadCore(0);
+    storeCore();
+    return true;
+}
+
+// Implements the C <snapshot> command
+void checkpoint(const Command &command) {
+    if (command.argKind != '"') {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Please give a file to write the checkpoint to (ex: C run.snap). \n";
+    } else if (writeSnapshot(command.stringArg)) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Checkpoint written to " << command.stringArg << " at time " << timestamp << ". \n";
+    }
+}
+
+// Implements the L <snapshot> command --> not while a trace is being recorded, since the trace couldn't say what was restored
+void restore(const Command &command) {
+    if (command.argKind != '"') {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Please give a checkpoint to restore (ex: L run.snap). \n";
+    } else if (tracer != NULL) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "A checkpoint can't be restored while a trace is being recorded. \n";
+    } else if (restoreSnapshot(command.stringArg)) {
+        if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "Restored " << pcbTable.live() << " processes from " << command.stringArg << " at time " << timestamp << ". \n";
+    }
+}
+
+// the checkpoint the process manager starts from instead of init (--restore=<snapshot>)
+thread_local string restorePath;
+
+// the program the first process runs (--init=<program>)
+thread_local string initPath = "init";
+
+int processCommands(CommandSource &commands);
+
+// Function that implements the process manager.
+int runProcessManager(CommandSource &commands) {
+    // Start with idle cores and empty ready queues, ordered by the policy chosen on the command line.
+    resetCores();
+    pcbTable.clear();
+    timestamp = 0;
+    timers.clear();
+    armedTimers = 0;
+    metrics.clear();
+    // Start from a checkpoint, if we were given one (see Snapshots).
+    if (!restorePath.empty()) return restoreSnapshot(restorePath) ? processCommands(commands) : EXIT_FAILURE;
+    // Attempt to create the init process.
+    int initProcess = pcbTable.allocate();
+    pcbTable.program[initProcess] = programCache.load(initPath);
+    if (!pcbTable.program[initProcess]) return EXIT_FAILURE;
+    pcbTable.processId[initProcess] = 0; // for process 0...
+    pcbTable.parentProcessId[initProcess] = -1;
+    pcbTable.hot[initProcess].programCounter = 0;
+    pcbTable.hot[initProcess].value = 0;
+    pcbTable.setState(initProcess, STATE_RUNNING);
+    pcbTable.startTime[initProcess] = 0;
+    pcbTable.finishTime[initProcess] = 0;
+    pcbTable.lastCore[initProcess] = 0;
+    metrics.started(initProcess);
+    // init starts out running on core 0
+    currentRunningProcessID = initProcess;
+    cpu.program = pcbTable.program[initProcess];
+    cpu.pProgram = cpu.program.get();
+    cpu.programCounter = pcbTable.hot[initProcess].programCounter;
+    cpu.value = pcbTable.hot[initProcess].value;
+    cpu.sliceUsed = 0;
+    storeCore();
+    double avgTurnaroundTime = 0;
+    return processCommands(commands);
+}
+
+// Runs the commands of the process manager, until a 'T' (or the end of the commands)
+int processCommands(CommandSource &commands) {
+    // Loop until a 'T' is read, then terminate.
+    Command command;
+    do {
+        // Read a command from the pipe.
+        if (!commands.next(command)) {
+            // Assume the parent process exited, breaking the pipe.
+            break;
+        }
+        if (tracer != NULL && command.argKind != '"') tracer->command(command);
+        switch (command.operation) {
+            case 'Q':
+            case 'q':
+                // batched forms run entirely inside this loop, with no reads from the pipe in between
+                if (command.argKind == '#') {
+                    runQuanta(command.intArg);
+                } else if (command.argKind == '*') {
+                    runUntilIdle();
+                } else if (command.argKind == '@') {
+                    runUntilTimestamp(command.intArg);
+                } else {
+                    quantum();
+                }
+                break;
+            case 'U':
+            case 'u':
+                if (command.argKind == '#') {
+                    unblockProcess(command.intArg);
+                } else {
+                    unblock(-1);
+                }
+                break;
+            case 'P':
+            case 'p':
+                print();
+                break;
+            case 'M':
+            case 'm':
+                printMetrics();
+                break;
+            case 'C':
+            case 'c':
+                checkpoint(command);
+                break;
+            case 'L':
+            case 'l':
+                restore(command);
+                break;
+            case 'D':
+            case 'd':
+                printProfile();
+                break;
+            case 'T':
+            case 't':
+                reporterProcess(); // create a final reporter process
+                if (logging(LOG_SUMMARY)) {
+                    LogLine(LOG_SUMMARY) << "Simulation terminated. \n";
+                    LogLine(LOG_SUMMARY) << "Average turnaround time: " << averageTurnaroundTime() << "\n";
+                }
+                if (cores.size() > 1) reportCores();
+                if (profiling()) printProfile();
+                break;
+            default:
+                if (logging(LOG_SUMMARY)) LogLine(LOG_SUMMARY) << "This is an invalid character! Please enter Q, U, P, M, C, L, D, or T. \n";
+        }
+    } while (command.operation != 'T'); // terminate if input is T
+    return EXIT_SUCCESS;
+}
+
+/*
+Benchmarks --> run with "./skeleton --bench <name>"
+    - these drive the process manager's functions directly, so they don't need the commander process or an "init" file
+*/
+
+// returns the time in seconds on a monotonic clock (only differences between two calls are meaningful)
+double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// returns the peak resident set size of this process so far, in kilobytes
+long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// returns allocations per operation as text, or n/a in a build that doesn't count them (see SIM_COUNT_ALLOCS)
+string allocationRate(unsigned long allocations, unsigned long operations) {
+    if (!COUNT_ALLOCS_BUILD) return "n/a";
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.4f", operations > 0 ? static_cast<double>(allocations) / operations : 0.0);
+    return rate;
+}
+
+/*
+silenceOutput() silences the simulation on the calling thread, until restoreOutput() is called
+    - everything a simulation prints goes through its logger, so turning that down to LOG_SILENT is enough --> the messages aren't even formatted
+    - only the calling thread's logger changes (see Logger), so what the benchmark itself prints, and any other simulation, is left alone
+*/
+thread_local LogLevel savedLogLevel = LOG_INSTRUCTION;
+
+void silenceOutput() {
+    savedLogLevel = logger.level;
+    logger.level = LOG_SILENT;
+}
+
+void restoreOutput() {
+    logger.level = savedLogLevel;
+}
+
+// "pcb" benchmark --> fork throughput and memory per process as the PCB table grows to 10, 10k and 1M processes
+void benchmarkPcbTable() {
+    const int sizes[] = {10, 10000, 1000000};
+    cout << "processes   forks/sec        table bytes/process   peak RSS (KB)" << endl;
+    for (int i = 0; i < 3; i++) {
+        // start from a single running process, just like runProcessManager() does
+        pcbTable.clear();
+        resetCores();
+        int initProcess = pcbTable.allocate();
+        pcbTable.setState(initProcess, STATE_RUNNING);
+        currentRunningProcessID = initProcess;
+        cpu.pProgram = &emptyProgram;
+        cpu.programCounter = 0;
+        cpu.value = 0;
+
+        double start = nowSeconds();
+        for (int n = 1; n < sizes[i]; n++) {
+            fork(1);
+        }
+        double elapsed = nowSeconds() - start;
+
+        size_t bytes = pcbTable.memoryUsage() + readyState->size() * sizeof(int);
+        double forksPerSecond = elapsed > 0 ? (sizes[i] - 1) / elapsed : 0;
+        printf("%-11d %-16.0f %-21.1f %ld\n", sizes[i], forksPerSecond, static_cast<double>(bytes) / sizes[i], peakRssKb());
+    }
+
+    // a child shares its parent's program, so a fork costs the same whatever the length of the program
+    const int lengths[] = {10, 10000, 1000000};
+    const int forks = 100000;
+    cout << "program length   forks/sec        allocations/fork" << endl;
+    for (int i = 0; i < 3; i++) {
+        shared_ptr<Program> program = make_shared<Program>();
+        for (int n = 0; n < lengths[i]; n++) {
+            Instruction instruction;
+            instruction.operation = "SAD"[n % 3];
+            instruction.intArg = n;
+            program->append(instruction);
+        }
+        pcbTable.clear();
+        resetCores();
+        int initProcess = pcbTable.allocate();
+        pcbTable.setState(initProcess, STATE_RUNNING);
+        pcbTable.program[initProcess] = program;
+        currentRunningProcessID = initProcess;
+        cpu.program = program;
+        cpu.pProgram = program.get();
+        cpu.programCounter = 0;
+        cpu.value = 0;
+
+        unsigned long allocations = heapAllocations;
+        double start = nowSeconds();
+        for (int n = 0; n < forks; n++) {
+            fork(1);
+        }
+        double elapsed = nowSeconds() - start;
+        allocations = heapAllocations - allocations;
+        bool shared = program.use_count() == forks + 3; // the parent, every child, the cpu and program itself
+        printf("%-16d %-16.0f %-16s %s\n", lengths[i], forks / elapsed, allocationRate(allocations, forks).c_str(),
+               shared ? "(one shared image)" : "(image COPIED)");
+        cpu.program.reset();
+        cpu.pProgram = &emptyProgram;
+    }
+    pcbTable.clear();
+    resetCores();
+    currentRunningProcessID = -1;
+}
+
+// one message of the transport benchmark --> when it was sent, followed by a command padded out to 16 bytes
+struct TransportBenchMessage {
+    long long sentNanos;
+    char command[8];
+};
+
+// returns the time in nanoseconds on the same monotonic clock as nowSeconds() (comparable across processes)
+long long nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// sends count messages from this process to a forked consumer over transport and has the consumer report commands/sec and latency
+//    - with paced == false the commander sends as fast as it can (measures throughput; latency then includes time spent queued)
+//    - with paced == true it pauses between messages, so the latency is that of a lone command reaching an idle process manager
+void measureTransport(CommandTransport &transport, const string &name, int count, bool paced) {
+    if (!transport.open()) {
+        cout << name << ": could not open transport (" << strerror(errno) << ")" << endl;
+        return;
+    }
+    cout.flush();
+    pid_t consumer = fork();
+    if (consumer == 0) {
+        transport.attachReceiver();
+        vector<long long> latencies;
+        latencies.reserve(count);
+        char buffer[4096];
+        size_t buffered = 0;
+        double start = 0;
+        while (static_cast<int>(latencies.size()) < count) {
+            ssize_t received = transport.receive(buffer + buffered, sizeof(buffer) - buffered);
+            if (received <= 0) break;
+            long long now = nowNanos();
+            if (start == 0) start = nowSeconds();
+            buffered += static_cast<size_t>(received);
+            size_t whole = buffered / sizeof(TransportBenchMessage);
+            for (size_t i = 0; i < whole; i++) {
+                TransportBenchMessage message;
+                memcpy(&message, buffer + i * sizeof(message), sizeof(message));
+                latencies.push_back(now - message.sentNanos);
+            }
+            buffered -= whole * sizeof(TransportBenchMessage);
+            memmove(buffer, buffer + whole * sizeof(TransportBenchMessage), buffered);
+        }
+        double elapsed = nowSeconds() - start;
+        sort(latencies.begin(), latencies.end());
+        size_t n = latencies.size();
+        printf("%-6s %-10s %-10zu %-16.0f %-12.2f %.2f\n", name.c_str(), paced ? "paced" : "streaming", n,
+               elapsed > 0 ? n / elapsed : 0,
+               n > 0 ? latencies[n / 2] / 1000.0 : 0,
+               n > 0 ? latencies[(n * 99) / 100] / 1000.0 : 0);
+        fflush(stdout);
+        transport.closeReceiver();
+        _exit(EXIT_SUCCESS);
+    }
+    transport.attachSender();
+    TransportBenchMessage message;
+    memset(&message, 0, sizeof(message));
+    memcpy(message.command, "Q\n", 2);
+    for (int i = 0; i < count; i++) {
+        message.sentNanos = nowNanos();
+        if (!transport.send(reinterpret_cast<const char *>(&message), sizeof(message))) break;
+        if (paced) {
+            struct timespec pause = {0, 20000};
+            nanosleep(&pause, NULL);
+        }
+    }
+    transport.closeSender();
+    waitpid(consumer, NULL, 0);
+}
+
+// "transport" benchmark --> commands/sec and per-command latency of the pipe and of the shared-memory ring
+void benchmarkTransport() {
+    cout << "transport mode  commands   commands/sec     p50 (us)     p99 (us)" << endl;
+    cout.flush();
+    for (int paced = 0; paced < 2; paced++) {
+        int count = paced ? 20000 : 2000000;
+        PipeTransport pipeTransport;
+        measureTransport(pipeTransport, "pipe", count, paced);
+        RingTransport ringTransport;
+        measureTransport(ringTransport, "ring", count, paced);
+    }
+}
+
+// the S/A/D kernels the "dispatch" benchmark runs through a table --> the same work as the op handlers, minus their output
+void kernelSet(Cpu &core, const Op &op) {
+    set(core, op.arg);
+}
+
+void kernelAdd(Cpu &core, const Op &op) {
+    add(core, op.arg);
+}
+
+void kernelDecrement(Cpu &core, const Op &op) {
+    decrement(core, op.arg);
+}
+
+// "dispatch" benchmark --> instructions/sec of the old copy-the-Instruction-and-switch step against the decoded Op table
+void benchmarkDispatch() {
+    const int programLength = 1 << 16;
+    const int passes = 200;
+    const OpHandler kernels[3] = {kernelSet, kernelAdd, kernelDecrement};
+
+    // an arithmetic-only program, held both the old way and the new way
+    vector<Instruction> instructions;
+    Program program;
+    for (int i = 0; i < programLength; i++) {
+        Instruction instruction;
+        instruction.operation = "SAD"[i % 3];
+        instruction.intArg = (i % 3 == 0) ? i : 7;
+        instruction.stringArg = to_string(instruction.intArg);
+        instructions.push_back(instruction);
+        program.append(instruction);
+    }
+    double total = static_cast<double>(programLength) * passes;
+    cout << "dispatch                 instructions/sec" << endl;
+
+    // before: copy the whole Instruction (string included) and switch on its operation
+    cpu.value = 0;
+    double start = nowSeconds();
+    for (int pass = 0; pass < passes; pass++) {
+        for (int pc = 0; pc < programLength; pc++) {
+            Instruction instruction;
+            instruction = instructions[pc];
+            switch (instruction.operation) {
+                case 'S': set(cpu, instruction.intArg); break;
+                case 'A': add(cpu, instruction.intArg); break;
+                case 'D': decrement(cpu, instruction.intArg); break;
+            }
+        }
+    }
+    double before = nowSeconds() - start;
+    int beforeValue = cpu.value;
+    printf("copy + switch            %.0f\n", total / before);
+
+    // after: index the 8-byte Op in place and call through the handler table
+    cpu.value = 0;
+    start = nowSeconds();
+    for (int pass = 0; pass < passes; pass++) {
+        const Op *ops = program.code();
+        for (int pc = 0; pc < programLength; pc++) {
+            kernels[ops[pc].opcode](cpu, ops[pc]);
+        }
+    }
+    double after = nowSeconds() - start;
+    printf("decoded Op + table       %.0f  (%.1fx, final values %s)\n", total / after, before / after,
+           beforeValue == cpu.value ? "match" : "DIFFER");
+}
+
+// writes text to path, returning false if the file couldn't be written
+bool writeFile(const string &path, const string &text) {
+    ofstream file(path.c_str());
+    file << text;
+    return file.good();
+}
+
+// "replace" benchmark --> a process R-replacing back and forth between two programs should parse each file once and keep memory flat
+void benchmarkReplace() {
+    char directory[] = "/tmp/skeleton-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+        return;
+    }
+    string programA = string(directory) + "/program_a";
+    string programB = string(directory) + "/program_b";
+    string body;
+    for (int i = 0; i < 1000; i++) body += "A 1\n";
+    writeFile(programA, body + "R " + programB + "\n");
+    writeFile(programB, body + "R " + programA + "\n");
+
+    pcbTable.clear();
+    resetCores();
+    int process = pcbTable.allocate();
+    pcbTable.setState(process, STATE_RUNNING);
+    currentRunningProcessID = process;
+    cpu.pProgram = &emptyProgram;
+
+    const int replaces = 1000000;
+    cout << "replaces   replaces/sec     parses   cached programs   peak RSS (KB)" << endl;
+    double start = nowSeconds();
+    for (int i = 1; i <= replaces; i++) {
+        replace(i % 2 ? programA : programB);
+        if (i == 1000 || i == replaces) {
+            double elapsed = nowSeconds() - start;
+            printf("%-10d %-16.0f %-8lu %-17zu %ld\n", i, i / elapsed, programCache.parses, programCache.size(), peakRssKb());
+        }
+    }
+
+    end();
+    unlink(programA.c_str());
+    unlink(programB.c_str());
+    rmdir(directory);
+    pcbTable.clear();
+}
+
+// the loader "loader" benchmarks against --> the old ifstream + getline + trim() + stringstream parse, counting instructions
+size_t legacyParseCount(const string &filename) {
+    ifstream file(filename.c_str());
+    size_t count = 0;
+    while (file.good()) {
+        string line;
+        getline(file, line);
+        trim(line);
+        if (line.size() > 0) {
+            Instruction instruction;
+            instruction.operation = toupper(line[0]);
+            instruction.stringArg = trim(line.erase(0, 1));
+            stringstream argStream(instruction.stringArg);
+            if (instruction.operation != 'R' && instruction.operation != 'B' && instruction.operation != 'E') argStream >> instruction.intArg;
+            count++;
+        }
+    }
+    return count;
+}
+
+// "loader" benchmark --> load time of a multi-million-line program: old stream parser, mmap parser, and mapped compiled program
+void benchmarkLoader() {
+    char directory[] = "/tmp/skeleton-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+        return;
+    }
+    string textPath = string(directory) + "/program";
+    string compiledPath = string(directory) + "/program.bin";
+    const int lines = 4000000;
+    string text;
+    text.reserve(lines * 10);
+    for (int i = 0; i < lines; i++) {
+        switch (i % 4) {
+            case 0: text += "S " + to_string(i) + "\n"; break;
+            case 1: text += "  A 19\n"; break;
+            case 2: text += "D 53   \n"; break;
+            case 3: text += "a -7\n"; break;
+        }
+    }
+    writeFile(textPath, text);
+
+    cout << "loader                   seconds     lines/sec" << endl;
+    double start = nowSeconds();
+    size_t legacyCount = legacyParseCount(textPath);
+    double legacy = nowSeconds() - start;
+    printf("ifstream + stringstream  %-11.3f %.0f\n", legacy, legacyCount / legacy);
+
+    Program parsed;
+    start = nowSeconds();
+    createProgram(textPath, parsed);
+    double mapped = nowSeconds() - start;
+    printf("mmap text parser         %-11.3f %.0f  (%.1fx)\n", mapped, parsed.size() / mapped, legacy / mapped);
+
+    writeCompiledProgram(parsed, compiledPath);
+    Program compiled;
+    start = nowSeconds();
+    createProgram(compiledPath, compiled);
+    double binary = nowSeconds() - start;
+    bool same = compiled.size() == parsed.size() && memcmp(compiled.code(), parsed.code(), parsed.size() * sizeof(Op)) == 0;
+    printf("mapped compiled program  %-11.6f %.0f  (%.0fx, %s)\n", binary, compiled.size() / binary, legacy / binary,
+           same ? "same Ops" : "Ops DIFFER");
+
+    unlink(textPath.c_str());
+    unlink(compiledPath.c_str());
+    rmdir(directory);
+}
+
+// "policy" benchmark --> cost of a dispatch (dequeue + re-enqueue) for every scheduling policy with 500k processes in the ready queue
+void benchmarkPolicies() {
+    const char *names[] = {"fifo", "lifo", "rr", "priority", "mlfq", "sri"};
+    const int readyProcesses = 500000;
+    const int dispatches = 2000000;
+    PolicyOptions savedOptions = policyOptions;
+    cout << "policy     ready      ns/dispatch" << endl;
+    for (int i = 0; i < 6; i++) {
+        policyOptions.name = names[i];
+        pcbTable.clear();
+        resetCores();
+        for (int n = 0; n < readyProcesses; n++) {
+            int process = pcbTable.allocate();
+            pcbTable.priority[process] = n % 3;
+            pcbTable.hot[process].programCounter = n % 1000;
+            readyState->enqueue(process);
+        }
+        double start = nowSeconds();
+        for (int n = 0; n < dispatches; n++) {
+            int process = readyState->dequeue();
+            timestamp++;
+            readyState->enqueue(process);
+        }
+        double elapsed = nowSeconds() - start;
+        printf("%-10s %-10zu %.1f\n", names[i], readyState->size(), elapsed * 1e9 / dispatches);
+    }
+    policyOptions = savedOptions;
+    pcbTable.clear();
+    resetCores();
+    timestamp = 0;
+}
+
+// "cores" benchmark --> simulated instructions/sec for the same workload on 1 to 64 cores (the quantum output is silenced)
+void benchmarkCores() {
+    const int processes = 256;
+    const int programLength = 4000;
+    shared_ptr<Program> program = make_shared<Program>();
+    for (int i = 0; i < programLength; i++) {
+        Instruction instruction;
+        instruction.operation = i + 1 == programLength ? 'E' : "SAD"[i % 3];
+        instruction.intArg = 7;
+        program->append(instruction);
+    }
+    unsigned int savedCores = coreCount;
+    cout << "cores   threads   quanta     instructions/sec   mean utilization   migrations" << endl;
+    for (unsigned int n = 1; n <= 64; n *= 2) {
+        coreCount = n;
+        pcbTable.clear();
+        resetCores();
+        timestamp = 0;
+        // every process starts out in core 0's ready queue, so the other cores only get work by stealing it
+        for (int i = 0; i < processes; i++) {
+            int process = pcbTable.allocate();
+            pcbTable.program[process] = program;
+            readyState->enqueue(process);
+        }
+        silenceOutput();
+        double start = nowSeconds();
+        for (size_t core = 0; core < cores.size(); core++) {
+            loadCore(static_cast<int>(core));
+            stealWork();
+            schedule();
+            storeCore();
+        }
+        runUntilIdle();
+        double elapsed = nowSeconds() - start;
+        restoreOutput();
+
+        unsigned long busy = 0;
+        unsigned long migrations = 0;
+        for (size_t core = 0; core < cores.size(); core++) {
+            busy += cores[core].busyQuanta;
+            migrations += cores[core].migrations;
+        }
+        printf("%-7u %-9zu %-10u %-18.0f %-18.1f %lu\n", n, coreThreads.size(), timestamp, busy / elapsed,
+               100.0 * busy / (static_cast<double>(timestamp) * n), migrations);
+        fflush(stdout);
+    }
+    coreCount = savedCores;
+    pcbTable.clear();
+    resetCores();
+    timestamp = 0;
+}
+
+/*
+Implements "--replay <trace>" --> runs the process manager on the commands recorded in trace, and checks every transition against the recording
+    - the simulation's own output is silenced; what we print is how fast the replay went and whether it matched
+    - run it from the directory the trace was recorded in, so the same program files are loaded
+*/
+int replayTrace(const string &filename) {
+    TraceReplayer replayer;
+    if (!replayer.open(filename)) return EXIT_FAILURE;
+    silenceOutput();
+    tracer = &replayer;
+    double start = nowSeconds();
+    int result = runProcessManager(replayer);
+    double elapsed = nowSeconds() - start;
+    tracer = NULL;
+    restoreOutput();
+    if (result != EXIT_SUCCESS) {
+        cout << "The process manager could not start (is the trace's init program in this directory?)" << endl;
+        return result;
+    }
+    replayer.finish();
+    printf("Replayed %zu events (%lu commands) in %.3f seconds: %.0f events/sec\n", replayer.size(), replayer.commandCount(), elapsed,
+           elapsed > 0 ? replayer.size() / elapsed : 0);
+    fflush(stdout);
+    if (replayer.mismatches > 0) {
+        cout << replayer.mismatches << " events did not match the trace. The first was event " << replayer.firstMismatch << ": expected "
+             << replayer.expectedEvent << ", but got " << replayer.actualEvent << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "Every transition matched the trace." << endl;
+    return EXIT_SUCCESS;
+}
+
+// "replay" benchmark --> records a run of a fork/block-heavy workload, then replays it
+void benchmarkReplay() {
+    char directory[] = "/tmp/skeleton-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+        return;
+    }
+    // the process manager loads "init" from the current directory
+    char *workingDirectory = getcwd(NULL, 0);
+    if (chdir(directory) != 0) {
+        cout << "Could not enter " << directory << ": " << strerror(errno) << endl;
+        free(workingDirectory);
+        return;
+    }
+    // init forks a worker every other instruction; each worker blocks once and then ends
+    string init;
+    for (int i = 0; i < 20000; i++) init += "F 1\nR worker\n";
+    init += "E\n";
+    writeFile("init", init);
+    writeFile("worker", "A 1\nB\nD 1\nE\n");
+    string script;
+    for (int i = 0; i < 1000000; i++) script += (i % 4 == 3) ? "U\n" : "Q\n";
+    script += "P\nT\n";
+
+    TraceWriter writer;
+    writer.open("trace");
+    tracer = &writer;
+    silenceOutput();
+    double start = nowSeconds();
+    CommandReader commands(script);
+    runProcessManager(commands);
+    double recorded = nowSeconds() - start;
+    restoreOutput();
+    tracer = NULL;
+    writer.close();
+    printf("Recorded the workload in %.3f seconds\n", recorded);
+    fflush(stdout);
+
+    replayTrace("trace");
+
+    unlink("trace");
+    unlink("init");
+    unlink("worker");
+    if (chdir(workingDirectory) != 0) cout << "Could not go back to " << workingDirectory << endl;
+    free(workingDirectory);
+    rmdir(directory);
+}
+
+/*
+WorkloadOptions class definition --> the knobs of a generated workload (see generateWorkload())
+    1. programLength --> arithmetic and B instructions in each process' program
+    2. fanOut / depth --> every process above the deepest level forks fanOut children, and the tree is depth levels deep below init
+    3. blockRatio --> the fraction of each program's instructions that are B
+    4. unblockRatio --> U commands sent per Q command
+    5. replaceInterval --> every replaceInterval instructions a program R-replaces itself with the next part of its program (0 = never)
+    6. ioTicks --> how long each B waits, as "B <ioTicks>" (0 = until a U)
+*/
+class WorkloadOptions {
+    public:
+        string name;
+        unsigned int programLength;
+        unsigned int fanOut;
+        unsigned int depth;
+        double blockRatio;
+        double unblockRatio;
+        unsigned int replaceInterval;
+        unsigned int ioTicks;
+
+        WorkloadOptions() : name("custom"), programLength(1000), fanOut(2), depth(3), blockRatio(0.01), unblockRatio(0.05), replaceInterval(0), ioTicks(0) {}
+
+        // number of processes the workload creates (init included)
+        unsigned long processes() const {
+            unsigned long total = 0;
+            unsigned long level = 1;
+            for (unsigned int d = 0; d <= depth; d++) {
+                total += level;
+                level *= fanOut;
+            }
+            return total;
+        }
+};
+
+// the program file for part part of the programs run at level level of the process tree (init is level 0, part 0)
+string workloadProgramName(unsigned int level, unsigned int part) {
+    if (level == 0 && part == 0) return "init";
+    return "level" + to_string(level) + "_part" + to_string(part);
+}
+
+/*
+generateWorkload() writes the programs of a workload into directory, and returns the commands that drive it
+    - level d's program starts with fanOut "F 1 / R <level d + 1>" pairs: the child runs the R and becomes a level d + 1 process, and the parent skips over it
+    - then come programLength instructions: mostly S/A/D, with a B spread evenly every 1 / blockRatio instructions
+    - with a replaceInterval, the program is split into parts of that many instructions, each ending in an R to the next part
+    - the commands are enough Q's to run every instruction (with some to spare for blocked processes), with a U every 1 / unblockRatio of them, then T
+        - with ioTicks, every B unblocks itself, so the commands are just "Q *" and T
+*/
+bool generateWorkload(const WorkloadOptions &options, const string &directory, string &commands) {
+    unsigned int parts = 1;
+    if (options.replaceInterval > 0) parts = (options.programLength + options.replaceInterval - 1) / options.replaceInterval;
+    if (parts == 0) parts = 1;
+    for (unsigned int level = 0; level <= options.depth; level++) {
+        double blocks = 0;
+        unsigned int written = 0;
+        for (unsigned int part = 0; part < parts; part++) {
+            string text;
+            if (part == 0 && level < options.depth) {
+                for (unsigned int child = 0; child < options.fanOut; child++) {
+                    text += "F 1\nR " + workloadProgramName(level + 1, 0) + "\n";
+                }
+            }
+            unsigned int length = options.replaceInterval > 0 ? min(options.replaceInterval, options.programLength - written) : options.programLength;
+            for (unsigned int i = 0; i < length; i++, written++) {
+                blocks += options.blockRatio;
+                if (blocks >= 1) {
+                    text += options.ioTicks > 0 ? "B " + to_string(options.ioTicks) + "\n" : "B\n";
+                    blocks -= 1;
+                    continue;
+                }
+                switch (written % 3) {
+                    case 0: text += "S " + to_string(written) + "\n"; break;
+                    case 1: text += "A " + to_string(level + 1) + "\n"; break;
+                    case 2: text += "D 1\n"; break;
+                }
+            }
+            text += part + 1 < parts ? "R " + workloadProgramName(level, part + 1) + "\n" : "E\n";
+            if (!writeFile(directory + "/" + workloadProgramName(level, part), text)) return false;
+        }
+    }
+    // every process runs its whole program, plus its forks and replaces
+    if (options.ioTicks > 0) {
+        commands = "Q *\nT\n";
+        return true;
     }
-    switch (instruction.operation) {
-        case 'S':
-            set(instruction.intArg);
-            cout << "Instruction S " << instruction.intArg << endl;
-            break;
-        case 'A':
-            add(instruction.intArg);
-            cout << "Instruction A " << instruction.intArg << endl;
-            break;
-        case 'D':
-            decrement(instruction.intArg);
-            cout << "Instruction D " << instruction.intArg << endl;
-            break;
-        case 'B':
-            cout << "Instruction B " << instruction.intArg << endl;
-            cout << "Process " << currentRunningProcessID << " has now been blocked. " << endl;
-            block();
-            break;
-        case 'E':
-            pcbEntry[currentRunningProcessID].finishTime = timestamp;  
-            cout << "Process " << currentRunningProcessID << " has been terminated. " << endl;
-            end();
-            break;
-        case 'F':
-            cout << "Instruction F " << instruction.intArg << endl;
-            cout << "Process " << currentRunningProcessID << " has been forked. " << endl;
-            fork(instruction.intArg);
-            cout << "Process " << currentRunningProcessID << " will begin running. " << endl;
-            break;
-        case 'R':
-            cout << "Instruction R " << instruction.stringArg << endl;
-            cout << "Process " << currentRunningProcessID << " has been replaced. " << endl;
-            replace(instruction.stringArg);
-            break;
+    unsigned long instructions = options.processes() * (options.programLength + 2 * options.fanOut + parts);
+    unsigned long quanta = instructions + instructions / 10 + 100;
+    double unblocks = 0;
+    commands.clear();
+    commands.reserve(quanta * 2);
+    for (unsigned long i = 0; i < quanta; i++) {
+        commands += "Q\n";
+        unblocks += options.unblockRatio;
+        while (unblocks >= 1) {
+            commands += "U\n";
+            unblocks -= 1;
+        }
     }
-    ++timestamp;
-    schedule();
+    commands += "T\n";
+    return true;
 }
 
-// Implements the U command.
-void unblock() {
-    // if blocked queue contains no processes, print message accordingly
-    if (blockedState.size() == 0) {
-        cout << "There are no currently blocked processes to unblock. " << endl;
-    } else { // otherwise, unblock 
-        // 1. If the blocked queue contains any processes:
-        //    a. Remove a process from the front of the blocked queue.
-        //    b. Add the process to the ready queue.
-        //    c. Change the state of the process to ready (update its PCB entry).
-        // 2. Call the schedule() function to give an unblocked process a chance to run (if possible).
+// Implements "--generate <directory> [length=<n>] [fanout=<n>] [depth=<n>] [block=<ratio>] [unblock=<ratio>] [replace=<n>] [io=<ticks>]"
+//    --> writes a workload's programs and its commands (to <directory>/commands, for piping into the simulator)
+//    - the directory is created (parents included) if it doesn't exist yet
+int generateWorkloadFiles(const string &directory, int argc, char *argv[]) {
+    WorkloadOptions options;
+    for (int i = 0; i < argc; i++) {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        string key = arg.substr(0, equals);
+        const char *value = equals == string::npos ? "" : arg.c_str() + equals + 1;
+        if (key == "length") {
+            options.programLength = static_cast<unsigned int>(strtoul(value, NULL, 10));
+        } else if (key == "fanout") {
+            options.fanOut = static_cast<unsigned int>(strtoul(value, NULL, 10));
+        } else if (key == "depth") {
+            options.depth = static_cast<unsigned int>(strtoul(value, NULL, 10));
+        } else if (key == "block") {
+            options.blockRatio = strtod(value, NULL);
+        } else if (key == "unblock") {
+            options.unblockRatio = strtod(value, NULL);
+        } else if (key == "replace") {
+            options.replaceInterval = static_cast<unsigned int>(strtoul(value, NULL, 10));
+        } else if (key == "io") {
+            options.ioTicks = static_cast<unsigned int>(strtoul(value, NULL, 10));
+        } else {
+            cout << "Unknown workload option " << arg << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    error_code error;
+    filesystem::create_directories(directory, error);
+    if (error) {
+        cout << "Error creating the directory " << directory << ": " << error.message() << endl;
+        return EXIT_FAILURE;
+    }
+    string commands;
+    if (!generateWorkload(options, directory, commands) || !writeFile(directory + "/commands", commands)) {
+        cout << "Error writing the workload into " << directory << endl;
+        return EXIT_FAILURE;
+    }
+    cout << "Wrote a workload of " << options.processes() << " processes into " << directory << " (run it with: cd " << directory << " && ./skeleton < commands)" << endl;
+    return EXIT_SUCCESS;
+}
 
-        // remove process at the front of the queue
-        int targetProcess = blockedState.front();
-        blockedState.pop_front();
+/*
+TimedCommandSource class definition --> hands out another source's commands, timing how long the process manager spends on each one
+    - a command's latency is the time from next() returning it to the process manager asking for the next command
+*/
+class TimedCommandSource : public CommandSource {
+    public:
+        vector<long long> latencies; // in nanoseconds, one per command
 
-        // add that removed process to the ready queue
-        readyState.push_back(targetProcess);
+        TimedCommandSource(CommandSource &commandSource) : source(&commandSource), returnedAt(0) {}
 
-        // set the state of the process to ready
-        pcbEntry[targetProcess].state = STATE_READY;
+        bool next(Command &command) {
+            long long now = nowNanos();
+            if (returnedAt != 0) latencies.push_back(now - returnedAt);
+            bool found = source->next(command);
+            returnedAt = nowNanos();
+            return found;
+        }
 
-        // call the schedule() function...
-        schedule();
-        cout << "Process " << targetProcess <<  " has now been unblocked. " << endl;
+    private:
+        CommandSource *source;
+        long long returnedAt;
+};
+
+// runs workload in directory (the current directory) and prints its results as a JSON object
+void runWorkload(const WorkloadOptions &options) {
+    // the names go into the JSON as they are, so they are escaped first
+    string name;
+    string policy;
+    appendJsonString(name, options.name.data(), options.name.size());
+    appendJsonString(policy, policyOptions.name.data(), policyOptions.name.size());
+    string commands;
+    if (!generateWorkload(options, ".", commands)) {
+        cout << "{\"name\": \"" << name << "\", \"error\": \"could not write the workload\"}";
+        return;
+    }
+    CommandReader reader(commands);
+    TimedCommandSource timed(reader);
+    silenceOutput();
+    double start = nowSeconds();
+    runProcessManager(timed);
+    double elapsed = nowSeconds() - start;
+    restoreOutput();
+
+    unsigned long instructions = 0;
+    for (size_t core = 0; core < cores.size(); core++) {
+        instructions += cores[core].busyQuanta;
     }
+    unsigned long forks = pcbTable.created - 1;
+    unsigned long finished = metrics.finished;
+    vector<long long> &latencies = timed.latencies;
+    sort(latencies.begin(), latencies.end());
+    size_t n = latencies.size();
+    printf("    {\"name\": \"%s\", \"program_length\": %u, \"fan_out\": %u, \"depth\": %u, \"block_ratio\": %g, \"unblock_ratio\": %g, \"replace_interval\": %u, \"io_ticks\": %u,\n",
+           name.c_str(), options.programLength, options.fanOut, options.depth, options.blockRatio, options.unblockRatio, options.replaceInterval, options.ioTicks);
+    printf("     \"cores\": %zu, \"policy\": \"%s\", \"processes\": %lu, \"finished\": %lu, \"commands\": %zu, \"quanta\": %u, \"seconds\": %.6f,\n",
+           cores.size(), policy.c_str(), pcbTable.created, finished, n + 1, timestamp, elapsed);
+    printf("     \"instructions\": %lu, \"instructions_per_sec\": %.0f, \"forks\": %lu, \"forks_per_sec\": %.0f,\n",
+           instructions, elapsed > 0 ? instructions / elapsed : 0, forks, elapsed > 0 ? forks / elapsed : 0);
+    printf("     \"command_latency_ns\": {\"p50\": %lld, \"p99\": %lld, \"max\": %lld}, \"peak_rss_kb\": %ld}",
+           n > 0 ? latencies[n / 2] : 0, n > 0 ? latencies[(n * 99) / 100] : 0, n > 0 ? latencies[n - 1] : 0, peakRssKb());
+    fflush(stdout);
 }
-// Implements the P command.
-void print() {
-    reporterProcess();
+
+/*
+"suite" benchmark --> runs a set of generated workloads end to end through runProcessManager() and prints the results as JSON
+    - each workload runs in its own forked process (in its own temporary directory), so its peak RSS is its own
+    - the simulation's output is silenced (see silenceOutput()), so this measures the simulator rather than the terminal
+*/
+void benchmarkSuite() {
+    WorkloadOptions workloads[6];
+    workloads[0].name = "cpu_bound";
+    workloads[0].programLength = 200000;
+    workloads[0].fanOut = 2;
+    workloads[0].depth = 2;
+    workloads[0].blockRatio = 0;
+    workloads[0].unblockRatio = 0;
+    workloads[1].name = "fork_heavy";
+    workloads[1].programLength = 20;
+    workloads[1].fanOut = 8;
+    workloads[1].depth = 5;
+    workloads[1].blockRatio = 0;
+    workloads[1].unblockRatio = 0;
+    workloads[2].name = "block_heavy";
+    workloads[2].programLength = 2000;
+    workloads[2].fanOut = 4;
+    workloads[2].depth = 3;
+    workloads[2].blockRatio = 0.1;
+    workloads[2].unblockRatio = 0.15;
+    workloads[3].name = "replace_heavy";
+    workloads[3].programLength = 5000;
+    workloads[3].fanOut = 3;
+    workloads[3].depth = 3;
+    workloads[3].blockRatio = 0.01;
+    workloads[3].unblockRatio = 0.02;
+    workloads[3].replaceInterval = 50;
+    workloads[4].name = "deep_tree";
+    workloads[4].programLength = 100;
+    workloads[4].fanOut = 2;
+    workloads[4].depth = 14;
+    workloads[4].blockRatio = 0.02;
+    workloads[4].unblockRatio = 0.03;
+    workloads[5].name = "io_bound";
+    workloads[5].programLength = 2000;
+    workloads[5].fanOut = 4;
+    workloads[5].depth = 3;
+    workloads[5].blockRatio = 0.05;
+    workloads[5].unblockRatio = 0;
+    workloads[5].ioTicks = 100000;
+
+    printf("{\"suite\": \"skeleton\", \"workloads\": [\n");
+    fflush(stdout);
+    for (int i = 0; i < 6; i++) {
+        char directory[] = "/tmp/skeleton-bench-XXXXXX";
+        if (mkdtemp(directory) == NULL) {
+            cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+            return;
+        }
+        pid_t runner = fork();
+        if (runner == 0) {
+            if (chdir(directory) != 0) _exit(EXIT_FAILURE);
+            runWorkload(workloads[i]);
+            _exit(EXIT_SUCCESS);
+        }
+        waitpid(runner, NULL, 0);
+        printf(i + 1 < 6 ? ",\n" : "\n");
+        fflush(stdout);
+        // the workload's files are all in directory, so clear them out
+        error_code error;
+        filesystem::remove_all(directory, error);
+        if (error) cout << "Could not remove " << directory << ": " << error.message() << endl;
+    }
+    printf("]}\n");
 }
 
-double averageTurnaroundTime() {
-    int totalTurnaroundTimes = 0;
-    for (int i = 0; i < numProcesses; i++) {
-        totalTurnaroundTimes += (pcbEntry[i].finishTime - pcbEntry[i].startTime);
-        // cout << "Process " << i << " started at " << (pcbEntry[i].startTime) << endl;
-        // cout << "Process " << i << " ended at " << (pcbEntry[i].finishTime) << endl;
+// what a run of the "superinstructions" benchmark ended with --> the two runs of each configuration must agree on all of it
+class FoldResult {
+    public:
+        double seconds;
+        unsigned int timestamp;
+        long long values;
+        unsigned long busyQuanta;
+        unsigned long finished;
+        double turnaround;
+
+        bool operator==(const FoldResult &other) const {
+            return timestamp == other.timestamp && values == other.values && busyQuanta == other.busyQuanta
+                && finished == other.finished && turnaround == other.turnaround;
+        }
+};
+
+// runs the workload in the current directory to completion with or without superinstructions
+FoldResult runFoldWorkload(bool superinstructions) {
+    useSuperinstructions = superinstructions;
+    // (the reader reads straight out of the string, so it has to outlive the reader)
+    string script = "Q *\nT\n";
+    CommandReader commands(script);
+    silenceOutput();
+    double start = nowSeconds();
+    runProcessManager(commands);
+    FoldResult result;
+    result.seconds = nowSeconds() - start;
+    restoreOutput();
+    result.timestamp = timestamp;
+    result.values = 0;
+    result.busyQuanta = 0;
+    for (size_t core = 0; core < cores.size(); core++) {
+        result.values += cores[core].value;
+        result.busyQuanta += cores[core].busyQuanta;
     }
-    return static_cast<double>(totalTurnaroundTimes)/numProcesses;
+    result.finished = metrics.finished;
+    result.turnaround = metrics.turnaround.mean();
+    return result;
 }
 
-// Function that implements the process manager.
-int runProcessManager(int fileDescriptor) {
-    // vector<PcbEntry> pcbTable;
-    // Attempt to create the init process.
-    if (!createProgram("init", pcbEntry[0].program)) return EXIT_FAILURE;
-    pcbEntry[0].processId = 0; // for process 0...
-    pcbEntry[0].parentProcessId = -1;
-    pcbEntry[0].programCounter = 0;
-    pcbEntry[0].value = 0;
-    pcbEntry[0].state = STATE_RUNNING;
-    pcbEntry[0].startTime = 0;
-    pcbEntry[0].finishTime = 0;
-    currentRunningProcessID = 0;
-    cpu.pProgram = &(pcbEntry[0].program);
-    cpu.programCounter = pcbEntry[0].programCounter;
-    cpu.value = pcbEntry[0].value;
-    timestamp = 0;
-    double avgTurnaroundTime = 0;
-    // Loop until a 'T' is read, then terminate.
-    char ch;
-    do {
-        // Read a command character from the pipe.
-        if (read(fileDescriptor, &ch, sizeof(ch)) != sizeof(ch)) {
-            // Assume the parent process exited, breaking the pipe.
-            break;
+// "superinstructions" benchmark --> an arithmetic-heavy workload run with and without superinstructions, under a few policies and core counts
+//    - init forks 3 workers, and each worker runs 10 stretches of 100000 S/A/D, with a "B 5" after each
+void benchmarkSuperinstructions() {
+    char directory[] = "/tmp/skeleton-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+        return;
+    }
+    string arithmetic;
+    for (int i = 0; i < 100000; i++) {
+        arithmetic += i % 3 == 0 ? "S " + to_string(i) + "\n" : (i % 3 == 1 ? "A 3\n" : "D 1\n");
+    }
+    string init;
+    for (int i = 0; i < 3; i++) init += "F 1\nR worker\n";
+    string worker;
+    for (int i = 0; i < 10; i++) worker += arithmetic + "B 5\n";
+    if (!writeFile(string(directory) + "/init", init + arithmetic + "E\n") || !writeFile(string(directory) + "/worker", worker + "E\n")) {
+        cout << "Could not write the workload into " << directory << endl;
+        return;
+    }
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL || chdir(directory) != 0) {
+        cout << "Could not enter " << directory << endl;
+        free(cwd);
+        return;
+    }
+    // holding on to the programs keeps them in the program cache, so neither run's time includes parsing them
+    ProgramHandle initProgram = programCache.load("init");
+    ProgramHandle workerProgram = programCache.load("worker");
+
+    const char *policies[] = {"fifo", "rr", "mlfq", "fifo"};
+    const unsigned int coreCounts[] = {1, 1, 1, 4};
+    PolicyOptions savedPolicy = policyOptions;
+    unsigned int savedCores = coreCount;
+    bool savedSuperinstructions = useSuperinstructions;
+    cout << "policy   cores   quanta     off (quanta/sec)   on (quanta/sec)    speedup   same result" << endl;
+    for (int i = 0; i < 4; i++) {
+        policyOptions = PolicyOptions();
+        policyOptions.name = policies[i];
+        coreCount = coreCounts[i];
+        FoldResult off = runFoldWorkload(false);
+        FoldResult on = runFoldWorkload(true);
+        printf("%-8s %-7u %-10u %-18.0f %-18.0f %-9.1f %s\n", policies[i], coreCounts[i], on.timestamp, off.timestamp / off.seconds,
+               on.timestamp / on.seconds, off.seconds / on.seconds, off == on ? "yes" : "NO");
+    }
+    policyOptions = savedPolicy;
+    coreCount = savedCores;
+    useSuperinstructions = savedSuperinstructions;
+
+    if (chdir(cwd) != 0) cout << "Could not go back to " << cwd << endl;
+    free(cwd);
+    error_code error;
+    filesystem::remove_all(directory, error);
+    if (error) cout << "Could not remove " << directory << ": " << error.message() << endl;
+}
+
+// one row of the churn benchmark
+class ChurnSample {
+    public:
+        unsigned long forks;
+        int slots;
+        size_t tableBytes;
+        unsigned long allocations; // since the last row
+        string allocationsPerFork;
+        long peakRssKb;
+};
+
+// the most heap allocations per fork the churn benchmark lets through while reaping (a fork measures ~0.008 today)
+const double CHURN_ALLOCATION_LIMIT = 0.02;
+
+// "churn" benchmark --> init forks 1M short-lived children (each R-replaces itself with kid, does some arithmetic and ends)
+//    - run once reaping finished processes (the default --retain-finished) and once keeping every one of them, as the table did before slots were reused
+//    - prints, every 200k forks, the size of the PCB table and how many heap allocations each fork cost since the last row (in a -DSIM_COUNT_ALLOCS=1 build)
+//    - returns false if, while reaping, the table grew after the first row, or (in a -DSIM_COUNT_ALLOCS=1 build) a row cost more than CHURN_ALLOCATION_LIMIT allocations per fork
+bool benchmarkChurn() {
+    char directory[] = "/tmp/skeleton-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+        return false;
+    }
+    const int forks = 1000000;
+    const int rows = 5;
+    string init;
+    for (int i = 0; i < forks; i++) init += "F 1\nR kid\n";
+    if (!writeFile(string(directory) + "/init", init + "E\n") || !writeFile(string(directory) + "/kid", "S 1\nA 2\nD 1\nE\n")) {
+        cout << "Could not write the workload into " << directory << endl;
+        return false;
+    }
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL || chdir(directory) != 0) {
+        cout << "Could not enter " << directory << endl;
+        free(cwd);
+        return false;
+    }
+
+    bool passed = true;
+    const int retained[] = {retainFinished, INT_MAX};
+    int savedRetain = retainFinished;
+    cout << "reaping   forks      PCB slots   table bytes   allocations/fork   peak RSS (KB)" << endl;
+    for (int run = 0; run < 2; run++) {
+        retainFinished = retained[run];
+        vector<ChurnSample> samples;
+        samples.reserve(rows);
+        silenceOutput();
+        // no commands --> this only sets up init, and we run the quanta ourselves
+        string noCommands;
+        CommandReader none(noCommands);
+        runProcessManager(none);
+        unsigned long lastForks = 0;
+        unsigned long lastAllocations = heapAllocations;
+        while (samples.size() < static_cast<size_t>(rows)) {
+            // each fork costs init one quantum, and the child one per instruction (R, S, A, D and E)
+            runQuanta(6 * forks / rows);
+            ChurnSample sample;
+            sample.forks = pcbTable.created - 1;
+            sample.slots = pcbTable.size();
+            sample.tableBytes = pcbTable.memoryUsage();
+            sample.allocations = heapAllocations - lastAllocations;
+            sample.allocationsPerFork = allocationRate(sample.allocations, sample.forks - lastForks);
+            sample.peakRssKb = peakRssKb();
+            samples.push_back(sample);
+            lastForks = sample.forks;
+            lastAllocations = heapAllocations;
         }
-        switch (ch) {
-            case 'Q':
-            case 'q':
-                quantum();
-                break;
-            case 'U':
-            case 'u':
-                unblock();
-                break;
-            case 'P':
-            case 'p':
-                print();
+        restoreOutput();
+        for (size_t i = 0; i < samples.size(); i++) {
+            printf("%-9s %-10lu %-11d %-13zu %-18s %ld\n", run == 0 ? "yes" : "no", samples[i].forks, samples[i].slots, samples[i].tableBytes,
+                   samples[i].allocationsPerFork.c_str(), samples[i].peakRssKb);
+        }
+        fflush(stdout);
+        if (run != 0) continue;
+        // while reaping, the table should stay the size it reached by the first row, and a fork should (almost) never allocate
+        for (size_t i = 1; i < samples.size(); i++) {
+            if (samples[i].slots != samples[0].slots || samples[i].tableBytes != samples[0].tableBytes) {
+                printf("FAILED: the PCB table grew from %d slots (%zu bytes) to %d slots (%zu bytes) while reaping\n", samples[0].slots,
+                       samples[0].tableBytes, samples[i].slots, samples[i].tableBytes);
+                passed = false;
                 break;
-            case 'T':
-            case 't':
-                reporterProcess(); // create a final reporter process
-                cout << "Simulation terminated. " << endl;
-                cout << "Average turnaround time: " << averageTurnaroundTime() << endl;
+            }
+        }
+        for (size_t i = 0; i < samples.size() && COUNT_ALLOCS_BUILD; i++) {
+            unsigned long rowForks = samples[i].forks - (i == 0 ? 0 : samples[i - 1].forks);
+            if (samples[i].allocations > CHURN_ALLOCATION_LIMIT * rowForks) {
+                printf("FAILED: %s allocations per fork while reaping (the limit is %g)\n", samples[i].allocationsPerFork.c_str(), CHURN_ALLOCATION_LIMIT);
+                passed = false;
                 break;
-            default:
-                cout << "This is an invalid character! Please enter Q, U, P, or T. " << endl;
+            }
         }
-    } while (ch != 'T'); // terminate if input is T
-    return EXIT_SUCCESS;
+    }
+    retainFinished = savedRetain;
+    pcbTable.clear();
+    resetCores();
+    timestamp = 0;
+
+    if (chdir(cwd) != 0) cout << "Could not go back to " << cwd << endl;
+    free(cwd);
+    error_code error;
+    filesystem::remove_all(directory, error);
+    if (error) cout << "Could not remove " << directory << ": " << error.message() << endl;
+    return passed;
+}
+
+// counts the commands source hands out (the ingestion the "script" benchmark times, without running them)
+size_t countCommands(CommandSource &source) {
+    Command command;
+    size_t count = 0;
+    while (source.next(command)) count++;
+    return count;
+}
+
+// "script" benchmark --> commands/sec getting a 2M-line script into the process manager: line by line through the pipe, as the commander does, and as a --script
+void benchmarkScript() {
+    char directory[] = "/tmp/skeleton-bench-XXXXXX";
+    if (mkdtemp(directory) == NULL) {
+        cout << "Could not create a temporary directory: " << strerror(errno) << endl;
+        return;
+    }
+    string scriptPath = string(directory) + "/script";
+    const int lines = 2000000;
+    string text;
+    text.reserve(lines * 8);
+    for (int i = 0; i < lines; i++) {
+        switch (i % 6) {
+            case 0: text += "Q " + to_string(i % 500) + "\n"; break;
+            case 1: text += "U 17\n"; break;
+            case 2: text += "q @" + to_string(i) + "\n"; break;
+            case 3: text += "# every few lines, a comment\n"; break;
+            case 4: text += "QQP\n"; break;
+            case 5: text += "  M\n"; break;
+        }
+    }
+    writeFile(scriptPath, text);
+
+    cout << "ingestion                     seconds     commands    commands/sec" << endl;
+    // the commander's way: getline(), then one send() per line into the pipe, with the process manager's CommandReader on the other end
+    PipeTransport pipeTransport;
+    if (!pipeTransport.open()) {
+        cout << "Could not open a pipe: " << strerror(errno) << endl;
+        return;
+    }
+    size_t piped = 0;
+    double start = nowSeconds();
+    thread receiver([&pipeTransport, &piped] {
+        CommandReader commands(pipeTransport);
+        piped = countCommands(commands);
+    });
+    ifstream file(scriptPath.c_str());
+    string line;
+    while (getline(file, line)) {
+        line += '\n';
+        if (!pipeTransport.send(line.data(), line.size())) break;
+    }
+    pipeTransport.closeSender();
+    receiver.join();
+    double lineByLine = nowSeconds() - start;
+    pipeTransport.closeReceiver();
+    printf("pipe, one send() per line     %-11.3f %-11zu %.0f\n", lineByLine, piped, piped / lineByLine);
+
+    // a script arriving on a pipe (ex: "--script -" at the end of a shell pipeline) --> read() in 64KB chunks
+    int descriptors[2];
+    if (pipe(descriptors) != 0) {
+        cout << "Could not open a pipe: " << strerror(errno) << endl;
+        return;
+    }
+    size_t chunked = 0;
+    start = nowSeconds();
+    thread writer([&text, &descriptors] {
+        size_t written = 0;
+        while (written < text.size()) {
+            ssize_t count = write(descriptors[1], text.data() + written, text.size() - written);
+            if (count <= 0) break;
+            written += static_cast<size_t>(count);
+        }
+        close(descriptors[1]);
+    });
+    ScriptSource streamed;
+    if (streamed.open("/dev/fd/" + to_string(descriptors[0]))) chunked = countCommands(streamed);
+    writer.join();
+    double reads = nowSeconds() - start;
+    streamed.close();
+    close(descriptors[0]);
+    printf("--script from a pipe          %-11.3f %-11zu %.0f  (%.1fx)\n", reads, chunked, chunked / reads, lineByLine / reads);
+
+    // a script file --> mapped, and parsed in place
+    ScriptSource mapped;
+    start = nowSeconds();
+    size_t inPlace = mapped.open(scriptPath) ? countCommands(mapped) : 0;
+    double mapping = nowSeconds() - start;
+    mapped.close();
+    printf("--script from a file (mmap)   %-11.3f %-11zu %.0f  (%.1fx)\n", mapping, inPlace, inPlace / mapping, lineByLine / mapping);
+    if (chunked != piped || inPlace != piped) cout << "Command counts DIFFER" << endl;
+
+    unlink(scriptPath.c_str());
+    rmdir(directory);
+}
+
+// "lockstep" benchmark --> instructions/sec of N cores running N processes of one arithmetic program in lockstep (superinstructions off), stepped one core
+// at a time and in lockstep groups with the scalar and the AVX2 kernel --> every process ends with a B, so its final value can be checked
+// then rr and mlfq (with boosts) on more processes than cores, checking the values, priorities and clock come out the same with lockstep on and off
+void benchmarkLockstep() {
+    const int programLength = 4000;
+    shared_ptr<Program> program = make_shared<Program>();
+    for (int i = 0; i < programLength; i++) {
+        Instruction instruction;
+        instruction.operation = i + 1 == programLength ? 'B' : "SAADD"[i % 5];
+        instruction.intArg = i % 5 == 0 ? i : 3 + i % 7;
+        program->append(instruction);
+    }
+    unsigned int savedCores = coreCount;
+    unsigned int savedThreads = threadCount;
+    bool savedLockstep = useLockstep;
+    bool savedSuperinstructions = useSuperinstructions;
+    LockstepKernel savedKernel = lockstep.kernel;
+    threadCount = 1;
+    useSuperinstructions = false;
+    static const char *const modes[] = {"one core at a time", "lockstep, scalar", "lockstep, AVX2"};
+    cout << "cores   stepping             instructions/sec   in groups   speedup   values" << endl;
+    for (unsigned int n = 64; n <= 4096; n *= 4) {
+        coreCount = n;
+        double baseline = 0;
+        vector<int> expected;
+        for (int mode = 0; mode < 3; mode++) {
+            if (mode == 2 && bestLockstepKernel() == lockstepScalar) {
+                printf("%-7u %-20s (this CPU has no AVX2)\n", n, modes[mode]);
+                continue;
+            }
+            useLockstep = mode > 0;
+            lockstep.kernel = mode == 2 ? bestLockstepKernel() : lockstepScalar;
+            lockstep.groupedSteps = 0;
+            pcbTable.clear();
+            resetCores();
+            timestamp = 0;
+            timers.clear();
+            armedTimers = 0;
+            // one process per core, each starting from its own value
+            for (unsigned int core = 0; core < n; core++) {
+                int process = pcbTable.allocate();
+                pcbTable.program[process] = program;
+                pcbTable.hot[process].value = static_cast<int>(core) * 7;
+                loadCore(static_cast<int>(core));
+                readyState->enqueue(process);
+                schedule();
+                storeCore();
+            }
+            silenceOutput();
+            double start = nowSeconds();
+            runUntilIdle();
+            double elapsed = nowSeconds() - start;
+            restoreOutput();
+
+            unsigned long busy = 0;
+            for (size_t core = 0; core < cores.size(); core++) busy += cores[core].busyQuanta;
+            vector<int> values;
+            for (int process = 0; process < pcbTable.size(); process++) values.push_back(pcbTable.hot[process].value);
+            if (mode == 0) {
+                baseline = busy / elapsed;
+                expected = values;
+            }
+            printf("%-7u %-20s %-18.0f %-11.1f %-9.2f %s\n", n, modes[mode], busy / elapsed, 100.0 * lockstep.groupedSteps / busy,
+                   busy / elapsed / baseline, values == expected ? "same" : "DIFFER");
+            fflush(stdout);
+        }
+    }
+
+    // more processes than cores, so the ready queues, their ticks and preemptions are exercised too
+    PolicyOptions savedPolicy = policyOptions;
+    static const char *const policies[] = {"rr", "mlfq"};
+    cout << endl << "policy  cores   processes   lockstep on vs off" << endl;
+    for (int i = 0; i < 2; i++) {
+        policyOptions = PolicyOptions();
+        policyOptions.name = policies[i];
+        policyOptions.timeSlice = 1;
+        policyOptions.levels = 4;
+        policyOptions.boostInterval = 7;
+        coreCount = LOCKSTEP_MIN_CORES;
+        const int processes = 60;
+        vector<int> results[2];
+        for (int mode = 0; mode < 2; mode++) {
+            useLockstep = mode == 1;
+            lockstep.kernel = bestLockstepKernel();
+            pcbTable.clear();
+            resetCores();
+            timestamp = 0;
+            timers.clear();
+            armedTimers = 0;
+            silenceOutput();
+            for (int n = 0; n < processes; n++) {
+                int process = pcbTable.allocate();
+                pcbTable.program[process] = program;
+                pcbTable.hot[process].value = n * 7;
+                loadCore(n % static_cast<int>(coreCount));
+                readyState->enqueue(process);
+                schedule();
+                storeCore();
+            }
+            for (int q = 0; q < 300; q++) quantum();
+            vector<int> &result = results[mode];
+            result.push_back(static_cast<int>(timestamp));
+            for (int process = 0; process < pcbTable.size(); process++) {
+                result.push_back(pcbTable.hot[process].value);
+                result.push_back(pcbTable.priority[process]);
+            }
+            runUntilIdle();
+            restoreOutput();
+            result.push_back(static_cast<int>(timestamp));
+            for (int process = 0; process < pcbTable.size(); process++) result.push_back(pcbTable.hot[process].value);
+        }
+        printf("%-7s %-7u %-11d %s\n", policies[i], coreCount, processes, results[0] == results[1] ? "same" : "DIFFER");
+    }
+    policyOptions = savedPolicy;
+    coreCount = savedCores;
+    threadCount = savedThreads;
+    useLockstep = savedLockstep;
+    useSuperinstructions = savedSuperinstructions;
+    lockstep.kernel = savedKernel;
+    pcbTable.clear();
+    resetCores();
+    timestamp = 0;
+    timers.clear();
+    armedTimers = 0;
+}
+
+/*
+Simulation options --> the command-line options that shape a simulation, as opposed to how it is driven (transport, logging, tracing)
+    - they set thread_local globals, so they only apply to the simulation on the calling thread
+    - a batch manifest can give any of them per run
+*/
+
+// applies arg if it is a simulation option, returning false if it isn't one
+bool parseSimulationOption(const string &arg) {
+    if (arg.compare(0, 9, "--policy=") == 0) {
+        policyOptions.name = arg.substr(9);
+    } else if (arg.compare(0, 8, "--slice=") == 0) {
+        policyOptions.timeSlice = static_cast<unsigned int>(strtoul(arg.c_str() + 8, NULL, 10));
+    } else if (arg.compare(0, 8, "--aging=") == 0) {
+        policyOptions.agingInterval = static_cast<unsigned int>(strtoul(arg.c_str() + 8, NULL, 10));
+    } else if (arg.compare(0, 9, "--levels=") == 0) {
+        policyOptions.levels = static_cast<unsigned int>(strtoul(arg.c_str() + 9, NULL, 10));
+    } else if (arg.compare(0, 8, "--boost=") == 0) {
+        policyOptions.boostInterval = static_cast<unsigned int>(strtoul(arg.c_str() + 8, NULL, 10));
+    } else if (arg.compare(0, 8, "--cores=") == 0) {
+        coreCount = static_cast<unsigned int>(strtoul(arg.c_str() + 8, NULL, 10));
+    } else if (arg.compare(0, 10, "--threads=") == 0) {
+        threadCount = static_cast<unsigned int>(strtoul(arg.c_str() + 10, NULL, 10));
+    } else if (arg.compare(0, 10, "--restore=") == 0) {
+        restorePath = arg.substr(10);
+    } else if (arg.compare(0, 7, "--init=") == 0) {
+        initPath = arg.substr(7);
+    } else if (arg == "--superinstructions=on") {
+        useSuperinstructions = true;
+    } else if (arg == "--superinstructions=off") {
+        useSuperinstructions = false;
+    } else if (arg == "--lockstep=on") {
+        useLockstep = true;
+    } else if (arg == "--lockstep=off") {
+        useLockstep = false;
+    } else if (arg.compare(0, 18, "--retain-finished=") == 0) {
+        unsigned long retain = strtoul(arg.c_str() + 18, NULL, 10);
+        retainFinished = retain < static_cast<unsigned long>(INT_MAX) ? static_cast<int>(retain) : INT_MAX;
+    } else if (arg == "--log=silent") {
+        logger.level = LOG_SILENT;
+    } else if (arg == "--log=summary") {
+        logger.level = LOG_SUMMARY;
+    } else if (arg == "--log=transition") {
+        logger.level = LOG_TRANSITION;
+    } else if (arg == "--log=instruction") {
+        logger.level = LOG_INSTRUCTION;
+    } else if (arg == "--log-format=text") {
+        logger.format = LOG_TEXT;
+    } else if (arg == "--log-format=jsonl") {
+        logger.format = LOG_JSONL;
+    } else if (arg.compare(0, 11, "--log-file=") == 0) {
+        logPath = arg.substr(11);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/*
+SimulationOptions class definition --> a copy of every simulation option, so it can be carried over to another thread
+    - capture() reads the calling thread's options, and apply() makes them the calling thread's options
+*/
+class SimulationOptions {
+    public:
+        PolicyOptions policy;
+        unsigned int cores;
+        unsigned int threads;
+        string restore;
+        string init;
+        bool superinstructions;
+        bool lockstepGroups;
+        int retain;
+        LogLevel logLevel;
+        LogFormat logFormat;
+        string logFile;
+
+        void capture() {
+            policy = policyOptions;
+            cores = coreCount;
+            threads = threadCount;
+            restore = restorePath;
+            init = initPath;
+            superinstructions = useSuperinstructions;
+            lockstepGroups = useLockstep;
+            retain = retainFinished;
+            logLevel = logger.level;
+            logFormat = logger.format;
+            logFile = logPath;
+        }
+
+        void apply() const {
+            policyOptions = policy;
+            coreCount = cores;
+            threadCount = threads;
+            restorePath = restore;
+            initPath = init;
+            useSuperinstructions = superinstructions;
+            useLockstep = lockstepGroups;
+            retainFinished = retain;
+            logger.level = logLevel;
+            logger.format = logFormat;
+            logPath = logFile;
+        }
+};
+
+/*
+Batch mode --> "--batch <manifest>" runs many independent simulations at once, on a pool of threads sized to the machine (or --jobs=<n>)
+    - each line of the manifest is one run: <name> <init program> <command script> [simulation options...]
+        - ex) rr-slice3 workloads/a/init workloads/a/commands --policy=rr --slice=3
+        - a run's options go on top of the ones given before --batch; blank lines and lines starting with # are skipped
+    - every run is a whole runProcessManager() over its command script, on whichever pool thread picks it up next
+        - the simulations share nothing (see the thread_local globals), so a sweep scales with the number of hardware threads
+        - each run steps its cores on its own thread (unless it asks for --threads), since the pool already keeps every hardware thread busy
+        - R instructions name files relative to the directory the batch was started in (threads can't each have their own)
+    - what gets printed is one JSON report with the results of every run, in manifest order
+        - so a run only logs if it names a file of its own to log into (ex: ... --log=transition --log-file=rr.log), and is silent otherwise
+        - each run has its own logger (see Logger), so its --log and --log-format only apply to its own file
+*/
+class BatchRun {
+    public:
+        // what to run (one manifest line)
+        string name;
+        string init;
+        string script;
+        vector<string> options;
+
+        // what came of it
+        string error; // empty if the run went fine
+        string policy;
+        unsigned int cores;
+        unsigned int quanta;
+        unsigned long processes;
+        unsigned long finished;
+        unsigned long instructions;
+        double meanTurnaround;
+        unsigned long p99Turnaround;
+        double meanWaiting;
+        double meanResponse;
+        double throughput;
+        double seconds;
+
+        BatchRun() : cores(0), quanta(0), processes(0), finished(0), instructions(0), meanTurnaround(0), p99Turnaround(0),
+                     meanWaiting(0), meanResponse(0), throughput(0), seconds(0) {}
+};
+
+// reads the runs listed in manifest into runs, returning false (after printing why) if a line is incomplete or the manifest can't be read
+bool readManifest(const string &manifest, vector<BatchRun> &runs) {
+    ifstream file(manifest.c_str());
+    if (!file) {
+        cout << "Error opening manifest " << manifest << endl;
+        return false;
+    }
+    string line;
+    int lineNum = 0;
+    while (getline(file, line)) {
+        lineNum++;
+        trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        istringstream fields(line);
+        BatchRun run;
+        string option;
+        if (!(fields >> run.name >> run.init >> run.script)) {
+            cout << manifest << ":" << lineNum << " - Expected <name> <init program> <command script> [options...]" << endl;
+            return false;
+        }
+        while (fields >> option) run.options.push_back(option);
+        runs.push_back(run);
+    }
+    return true;
+}
+
+// runs one line of the manifest on the calling thread, starting from the batch's options
+void runBatchRun(BatchRun &run, const SimulationOptions &batchOptions) {
+    batchOptions.apply();
+    for (size_t i = 0; i < run.options.size(); i++) {
+        if (!parseSimulationOption(run.options[i])) {
+            run.error = "unknown option " + run.options[i];
+            return;
+        }
+    }
+    initPath = run.init;
+    if (logPath.empty()) logger.level = LOG_SILENT;
+    SchedulingPolicy *probe = createPolicy(policyOptions);
+    if (probe == NULL || coreCount == 0) {
+        run.error = probe == NULL ? "unknown policy " + policyOptions.name : "no cores";
+        return;
+    }
+    delete probe;
+    ScriptSource commands;
+    if (!commands.open(run.script)) {
+        run.error = "could not open " + run.script;
+        return;
+    }
+    if (!logPath.empty() && !logger.openFile(logPath)) {
+        run.error = "could not create " + logPath;
+        return;
+    }
+    logger.start();
+    double start = nowSeconds();
+    int status = runProcessManager(commands);
+    run.seconds = nowSeconds() - start;
+    logger.stop();
+    logger.closeFile();
+    if (status != EXIT_SUCCESS) run.error = restorePath.empty() ? "could not load " + run.init : "could not restore " + restorePath;
+
+    run.policy = policyOptions.name;
+    run.cores = coreCount;
+    run.quanta = timestamp;
+    run.processes = pcbTable.created;
+    run.finished = metrics.finished;
+    for (size_t core = 0; core < cores.size(); core++) {
+        run.instructions += cores[core].busyQuanta;
+    }
+    run.meanTurnaround = metrics.turnaround.mean();
+    run.p99Turnaround = static_cast<unsigned long>(metrics.turnaround.percentile(0.99));
+    run.meanWaiting = metrics.waiting.mean();
+    run.meanResponse = metrics.response.mean();
+    run.throughput = metrics.throughput();
+
+    // let go of the run's processes (the thread may be around for a while yet)
+    pcbTable.clear();
+}
+
+// appends name and value to report as a JSON string field
+void appendJsonField(string &report, const char *name, const string &value) {
+    report += string("\"") + name + "\": \"";
+    appendJsonString(report, value.data(), value.size());
+    report += "\", ";
+}
+
+// Implements "--batch <manifest>" --> prints the JSON report and returns EXIT_FAILURE if any run failed
+int runBatch(const string &manifest, unsigned int jobs) {
+    vector<BatchRun> runs;
+    if (!readManifest(manifest, runs)) return EXIT_FAILURE;
+    SimulationOptions batchOptions;
+    batchOptions.capture();
+    if (batchOptions.threads == 0) batchOptions.threads = 1;
+    if (jobs == 0) jobs = max(1u, thread::hardware_concurrency());
+    if (jobs > runs.size()) jobs = max<size_t>(1, runs.size());
+
+    // every pool thread takes the next run nobody has started yet, until there are none left
+    atomic<size_t> next(0);
+    double start = nowSeconds();
+    vector<thread> pool;
+    for (unsigned int i = 0; i < jobs; i++) {
+        pool.push_back(thread([&runs, &next, &batchOptions] {
+            for (size_t run = next++; run < runs.size(); run = next++) {
+                runBatchRun(runs[run], batchOptions);
+            }
+        }));
+    }
+    for (size_t i = 0; i < pool.size(); i++) {
+        pool[i].join();
+    }
+    double elapsed = nowSeconds() - start;
+
+    double runSeconds = 0;
+    int failed = 0;
+    string report = "{\"manifest\": \"";
+    appendJsonString(report, manifest.data(), manifest.size());
+    report += "\", \"jobs\": " + to_string(jobs) + ", \"runs\": [\n";
+    for (size_t i = 0; i < runs.size(); i++) {
+        const BatchRun &run = runs[i];
+        char numbers[512];
+        report += "    {";
+        appendJsonField(report, "name", run.name);
+        appendJsonField(report, "init", run.init);
+        appendJsonField(report, "commands", run.script);
+        if (!run.error.empty()) {
+            failed++;
+            report += "\"error\": \"";
+            appendJsonString(report, run.error.data(), run.error.size());
+            report += "\"}";
+        } else {
+            appendJsonField(report, "policy", run.policy);
+            snprintf(numbers, sizeof(numbers), "\"cores\": %u, \"quanta\": %u, \"processes\": %lu, \"finished\": %lu, \"instructions\": %lu, "
+                     "\"mean_turnaround\": %.2f, \"p99_turnaround\": %lu, \"mean_waiting\": %.2f, \"mean_response\": %.2f, \"throughput\": %g, \"seconds\": %.6f}",
+                     run.cores, run.quanta, run.processes, run.finished, run.instructions, run.meanTurnaround, run.p99Turnaround,
+                     run.meanWaiting, run.meanResponse, run.throughput, run.seconds);
+            report += numbers;
+        }
+        report += i + 1 < runs.size() ? ",\n" : "\n";
+        runSeconds += run.seconds;
+    }
+    char totals[256];
+    snprintf(totals, sizeof(totals), "], \"failed\": %d, \"seconds\": %.6f, \"run_seconds\": %.6f, \"speedup\": %.2f}\n",
+             failed, elapsed, runSeconds, elapsed > 0 ? runSeconds / elapsed : 0);
+    report += totals;
+    cout << report << flush;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+runScript() runs the process manager on the commands in a script (--script <file>), with no commander process at all
+    - no prompt, no pipe, and no fork() --> the commands go straight from the mapped file to runProcessManager()
+    - the output is the same as for the same commands typed at the prompt, minus the prompts
+*/
+int runScript(const string &path, const string &tracePath) {
+    ScriptSource commands;
+    if (!commands.open(path)) {
+        cout << "Error opening script " << path << ": " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+    if (!logPath.empty() && !logger.openFile(logPath)) {
+        cout << "Error creating log " << logPath << ": " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+    TraceWriter traceWriter;
+    if (!tracePath.empty()) {
+        if (!traceWriter.open(tracePath)) {
+            cout << "Error creating trace " << tracePath << ": " << strerror(errno) << endl;
+            return EXIT_FAILURE;
+        }
+        tracer = &traceWriter;
+    }
+    cout.flush();
+    logger.start();
+    int result = runProcessManager(commands);
+    traceWriter.close();
+    tracer = NULL;
+    logger.stop();
+    logger.closeFile();
+    return result;
+}
+
+// runs the benchmark called name, returning EXIT_FAILURE if there is no such benchmark (or it found a regression, ex: "churn")
+int runBenchmark(const string &name) {
+    if (name == "pcb") {
+        benchmarkPcbTable();
+        return EXIT_SUCCESS;
+    }
+    if (name == "transport") {
+        benchmarkTransport();
+        return EXIT_SUCCESS;
+    }
+    if (name == "dispatch") {
+        benchmarkDispatch();
+        return EXIT_SUCCESS;
+    }
+    if (name == "replace") {
+        benchmarkReplace();
+        return EXIT_SUCCESS;
+    }
+    if (name == "loader") {
+        benchmarkLoader();
+        return EXIT_SUCCESS;
+    }
+    if (name == "policy") {
+        benchmarkPolicies();
+        return EXIT_SUCCESS;
+    }
+    if (name == "cores") {
+        benchmarkCores();
+        return EXIT_SUCCESS;
+    }
+    if (name == "replay") {
+        benchmarkReplay();
+        return EXIT_SUCCESS;
+    }
+    if (name == "suite") {
+        benchmarkSuite();
+        return EXIT_SUCCESS;
+    }
+    if (name == "superinstructions") {
+        benchmarkSuperinstructions();
+        return EXIT_SUCCESS;
+    }
+    if (name == "churn") {
+        return benchmarkChurn() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (name == "script") {
+        benchmarkScript();
+        return EXIT_SUCCESS;
+    }
+    if (name == "lockstep") {
+        benchmarkLockstep();
+        return EXIT_SUCCESS;
+    }
+    cout << "Unknown benchmark " << name << ". Available benchmarks: pcb, transport, dispatch, replace, loader, policy, cores, replay, suite, superinstructions, churn, script, lockstep" << endl;
+    return EXIT_FAILURE;
+}
+
+// prints how to run the simulator
+void printUsage(const char *program) {
+    cout << "Usage: " << program << " [--transport=pipe|ring] [--policy=fifo|lifo|rr|priority|mlfq|sri]" << endl;
+    cout << "       " << string(strlen(program) + 7, ' ') << "[--slice=<quanta>] [--aging=<quanta>] [--levels=<n>] [--boost=<quanta>]" << endl;
+    cout << "       " << string(strlen(program) + 7, ' ') << "[--cores=<n>] [--threads=<n>] [--record=<trace>] [--restore=<snapshot>]" << endl;
+    cout << "       " << string(strlen(program) + 7, ' ') << "[--superinstructions=on|off] [--lockstep=on|off] [--retain-finished=<n>]" << endl;
+    cout << "       " << string(strlen(program) + 7, ' ') << "[--init=<program>]" << endl;
+    cout << "       " << string(strlen(program) + 7, ' ') << "[--log=silent|summary|transition|instruction] [--log-format=text|jsonl] [--log-file=<file>]" << endl;
+    cout << "       " << string(strlen(program) + 7, ' ') << "[--profile[=perf]] (in a build with -DSIM_PROFILE=1)" << endl;
+    cout << "       " << program << " [options] --script <file|->" << endl;
+    cout << "       " << program << " [simulation options] --batch <manifest> [--jobs=<n>]" << endl;
+    cout << "       " << program << " --replay <trace>" << endl;
+    cout << "       " << program << " --compile <program> <compiled program>" << endl;
+    cout << "       " << program << " --generate <new or existing directory> [length=<n>] [fanout=<n>] [depth=<n>] [block=<ratio>] [unblock=<ratio>] [replace=<n>] [io=<ticks>]" << endl;
+    cout << "       " << program << " --bench <pcb|transport|dispatch|replace|loader|policy|cores|replay|suite|superinstructions|churn|script|lockstep>" << endl;
 }
 
 int main(int argc, char *argv[]) {
-    int pipeDescriptors[2];
+    string transportName = "pipe";
+    string tracePath;
+    string batchPath;
+    string scriptPath;
+    unsigned int jobs = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--bench" && i + 1 < argc) {
+            return runBenchmark(argv[i + 1]);
+        } else if (arg == "--compile" && i + 2 < argc) {
+            return compileProgram(argv[i + 1], argv[i + 2]);
+        } else if (arg == "--generate" && i + 1 < argc) {
+            return generateWorkloadFiles(argv[i + 1], argc - i - 2, argv + i + 2);
+        } else if (arg == "--replay" && i + 1 < argc) {
+            return replayTrace(argv[i + 1]);
+        } else if (arg.compare(0, 9, "--record=") == 0) {
+            tracePath = arg.substr(9);
+        } else if (arg == "--script" && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batchPath = argv[++i];
+        } else if (arg.compare(0, 7, "--jobs=") == 0) {
+            jobs = static_cast<unsigned int>(strtoul(arg.c_str() + 7, NULL, 10));
+        } else if (parseSimulationOption(arg)) {
+            // (an option of the simulation itself)
+        } else if (arg.compare(0, 12, "--transport=") == 0) {
+            transportName = arg.substr(12);
+        } else if (arg == "--profile" || arg == "--profile=perf") {
+            if (!PROFILE_BUILD) cout << "This build has no profiler, so " << arg << " does nothing (build with -DSIM_PROFILE=1)." << endl;
+            profiler.enabled = true;
+            profiler.hardware = arg == "--profile=perf";
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!batchPath.empty()) {
+        // every run of the batch would record (or log) into the same file at once
+        if (!tracePath.empty()) {
+            cout << "--record can't be combined with --batch (the runs would all write the same trace)." << endl;
+            return EXIT_FAILURE;
+        }
+        if (!logPath.empty()) {
+            cout << "--log-file can't be combined with --batch (give each run a --log-file of its own in the manifest)." << endl;
+            return EXIT_FAILURE;
+        }
+        return runBatch(batchPath, jobs);
+    }
+    // Check the policy name now, before we fork (the process manager builds its own copy).
+    SchedulingPolicy *policy = createPolicy(policyOptions);
+    if (policy == NULL) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    delete policy;
+    if (coreCount == 0) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // A script runs right here, with no commander (and so no prompt or pipe).
+    if (!scriptPath.empty()) return runScript(scriptPath, tracePath);
+    // The pipe is the default transport; --transport=ring swaps in the shared-memory ring buffer.
+    PipeTransport pipeTransport;
+    RingTransport ringTransport;
+    CommandTransport *transport;
+    if (transportName == "pipe") {
+        transport = &pipeTransport;
+    } else if (transportName == "ring") {
+        transport = &ringTransport;
+    } else {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
     pid_t processMgrPid;
-    char ch;
+    string line;
+    bool terminated = false;
     int result;
-    // Create a pipe
-    pipe(pipeDescriptors);
+    // Create the pipe (or ring buffer)
+    if (!transport->open()) {
+        cout << "Error creating the " << transportName << " transport: " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
     // Use fork() SYSTEM CALL to create the child process and save the value returned in processMgrPid variable
     if((processMgrPid = fork()) == -1) exit(1);    /* FORK FAILED */
     if (processMgrPid == 0) {
         // The process manager process is running --> close the unused write end of the pipe for the process manager process.
-        close(pipeDescriptors[1]);
+        transport->attachReceiver();
+
+        // Record a trace of the run, if we were asked to.
+        TraceWriter traceWriter;
+        if (!tracePath.empty()) {
+            if (!traceWriter.open(tracePath)) {
+                cout << "Error creating trace " << tracePath << ": " << strerror(errno) << endl;
+                _exit(EXIT_FAILURE);
+            }
+            tracer = &traceWriter;
+        }
 
-        // Run the process manager.
-        result = runProcessManager(pipeDescriptors[0]);
+        // Run the process manager, with its output written out by the logger's background thread (into the --log-file, if there is one).
+        if (!logPath.empty() && !logger.openFile(logPath)) {
+            cout << "Error creating log " << logPath << ": " << strerror(errno) << endl;
+            _exit(EXIT_FAILURE);
+        }
+        logger.start();
+        CommandReader commands(*transport);
+        result = runProcessManager(commands);
+        traceWriter.close();
+        logger.stop();
+        logger.closeFile();
 
         // Close the read end of the pipe for the process manager process (for cleanup purposes).
-        close(pipeDescriptors[0]);
+        transport->closeReceiver();
         _exit(result);
     } else {
         // The commander process is running --> close the unused read end of the pipe for the commander process.
-        close(pipeDescriptors[0]);
+        transport->attachSender();
         // Loop until a 'T' is written or until the pipe is broken.
         do {
-            cout << "Enter Q, P, U or T" << endl;
+            cout << "Enter Q, P, U, M, C, L, D or T" << endl;
             cout << "$ ";
-            cin >> ch ;
-            // Pass commands to the process manager process via the pipe.
-            if (write(pipeDescriptors[1], &ch, sizeof(ch)) != sizeof(ch)) {
+            if (!getline(cin, line)) break;
+            // Pass the whole line to the process manager process via the pipe (so "Q 500" arrives in one piece).
+            line += '\n';
+            if (!transport->send(line.data(), line.size())) {
                 // Assume the child process exited, breaking the pipe.
-                break; 
+                break;
+            }
+            // Stop once the line contained a T.
+            CommandReader lineCommands(line);
+            Command command;
+            while (lineCommands.next(command)) {
+                if (command.operation == 'T') terminated = true;
             }
-        } while (ch != 'T');
-        write(pipeDescriptors[1], &ch, sizeof(ch));
+        } while (!terminated);
 
         // Close the write end of the pipe for the commander process (for cleanup purposes).
-        close(pipeDescriptors[1]);
+        transport->closeSender();
 
         // Wait for the process manager to exit.
         wait(&result);